@@ -2,7 +2,6 @@
 
 int main()
 {
- char perfomance[8];
  DINGUXGDK::Backlight light;
  DINGUXGDK::Screen screen;
  DINGUXGDK::Gamepad gamepad;
@@ -12,17 +11,19 @@ int main()
  DINGUXGDK::Timer timer;
  DINGUXGDK::Image image;
  DINGUXGDK::Background space;
- DINGUXGDK::Sprite ship,font;
- DINGUXGDK::Text text;
+ DINGUXGDK::Sprite ship;
+ DINGUXGDK::Font font;
+ DINGUXGDK::Text_Label perfomance;
  screen.initialize();
+ image.set_transfer(true);
  image.load_tga("space.tga");
  space.load_image(image);
  image.load_tga("ship.tga");
  ship.load_sprite(image,HORIZONTAL_STRIP,2);
  ship.set_position(screen.get_width()/2,screen.get_height()/2);
  image.load_tga("font.tga");
- font.load_image(image);
- text.load_font(font.get_handle());
+ font.load_font(image);
+ perfomance.load_font(font.get_handle());
  gamepad.initialize();
  space.initialize(screen.get_handle());
  ship.initialize(screen.get_handle());
@@ -30,14 +31,13 @@ int main()
  space.resize_image(screen.get_width(),screen.get_height());
  space.set_kind(NORMAL_BACKGROUND);
  screen.clear_screen();
- text.set_position(font.get_width(),font.get_height());
+ perfomance.set_position(font.get_font_width(),font.get_font_height());
  timer.set_timer(1);
  sound.initialize(44100);
  player.initialize(sound.get_handle());
  audio.load_wave("space.wav");
  player.load(audio.get_handle());
  light.set_light(light.get_minimum());
- memset(perfomance,0,8);
  while(1)
  {
   screen.update();
@@ -56,9 +56,9 @@ int main()
   if (gamepad.check_hold(BUTTON_RIGHT)==true) ship.increase_x(4);
   if (ship.get_x()>screen.get_width()) ship.set_x(screen.get_width()/2);
   if (ship.get_y()>screen.get_height()) ship.set_y(screen.get_height()/2);
-  sprintf(perfomance,"%lu",screen.get_fps());
+  perfomance.set_number(screen.get_fps());
   space.draw_background();
-  text.draw_text(perfomance);
+  perfomance.draw_label();
   ship.draw_sprite();
   if (timer.check_timer()==true)
   {
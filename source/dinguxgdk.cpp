@@ -28,34 +28,100 @@ SVGALib homepage: http://www.svgalib.org/
 #include "dinguxgdk.h"
 
 const int SOUND_CHANNELS=2;
+const size_t SOUND_PERIODS=4;
+const size_t SOUND_MIN_PERIODS=2;
+const size_t MIXER_VOICES=8;
+const size_t MIXER_NONE=static_cast<size_t>(-1);
+const size_t MIXER_FRAME=4;
+const unsigned short int MIXER_UNITY=32767;
+const int MIXER_ROUND=16384;
+const size_t MUSIC_PERIODS=8;
+const size_t MUSIC_MIN_PERIODS=2;
+const size_t MUSIC_FRAMES=4096;
+const unsigned long int MIXER_STEP=65536;
 const unsigned char GAMEPAD_PRESS=1;
 const unsigned char GAMEPAD_RELEASE=0;
 const size_t BUTTON_AMOUNT=16;
+const unsigned long int MASK_BITS=sizeof(unsigned long int)*CHAR_BIT;
+const size_t PARALLAX_LAYERS=8;
+const size_t BACKGROUND_CACHE=1048576;
+const size_t TILEMAP_CHUNKS=9;
+const size_t MAP_HEAD_LENGTH=20;
+const size_t FONT_GLYPHS=128;
+const size_t NUMBER_LENGTH=24;
+const size_t MAP_ENTRY_LENGTH=8;
+const size_t MAP_NONE=static_cast<size_t>(-1);
+const unsigned char MAP_SLOT_EMPTY=0;
+const unsigned char MAP_SLOT_REQUESTED=1;
+const unsigned char MAP_SLOT_LOADING=2;
+const unsigned char MAP_SLOT_READY=3;
+const unsigned char LOAD_WAVE=2;
+const size_t LOAD_NONE=static_cast<size_t>(-1);
+const size_t LOAD_PAGE=4096;
+const size_t ASSET_HEAD_LENGTH=44;
+const size_t ASSET_ALIGN=16;
+const unsigned char ASSET_RGB565=1;
+const unsigned long int ASSET_MASK_BITS=32;
+const size_t CACHE_NONE=static_cast<size_t>(-1);
+const size_t CACHE_BUDGET=8388608;
+const size_t SHEET_CACHE=8;
+const unsigned short int ASSET_SPLIT=1;
+const size_t PACK_HEAD_LENGTH=16;
+const size_t PACK_ENTRY_LENGTH=64;
+const size_t PACK_ALIGN=16;
+const size_t PACK_NONE=static_cast<size_t>(-1);
+const unsigned long int PACK_COMPRESSED=1;
+const size_t PACK_HASH_BITS=12;
+const size_t PACK_MIN_MATCH=4;
+const size_t PACK_LAST_LITERALS=5;
+const size_t PACK_MAX_OFFSET=65535;
 
-namespace OSS_BACKEND
+namespace DINGUXGDK
+{
+
+void* sound_stream_worker(void *target)
 {
- volatile int sound_device=-1;
- volatile size_t sound_buffer_length=0;
- volatile bool run_stream=true;
- volatile bool do_play=false;
+ static_cast<Sound*>(target)->play_sound();
+ return NULL;
 }
 
-namespace DINGUXGDK
+size_t load_counter(const volatile size_t &counter)
 {
+ size_t value;
+ #if defined(__ATOMIC_ACQUIRE)
+ value=__atomic_load_n(&counter,__ATOMIC_ACQUIRE);
+ #else
+ value=counter;
+ __sync_synchronize();
+ #endif
+ return value;
+}
 
-void* oss_play_sound(void *buffer)
+void store_counter(volatile size_t &counter,const size_t value)
 {
- while (OSS_BACKEND::run_stream)
- {
-  if (OSS_BACKEND::do_play)
-  {
-   write(OSS_BACKEND::sound_device,buffer,OSS_BACKEND::sound_buffer_length);
-   OSS_BACKEND::do_play=false;
-  }
+ #if defined(__ATOMIC_RELEASE)
+ __atomic_store_n(&counter,value,__ATOMIC_RELEASE);
+ #else
+ __sync_synchronize();
+ counter=value;
+ #endif
+}
 
- }
- if (buffer!=NULL) free(buffer);
- if (OSS_BACKEND::sound_device!=-1) close(OSS_BACKEND::sound_device);
+void* map_stream_worker(void *target)
+{
+ static_cast<Map_Stream*>(target)->load_chunks();
+ return NULL;
+}
+
+void* asset_loader_worker(void *target)
+{
+ static_cast<Asset_Loader*>(target)->load_assets();
+ return NULL;
+}
+
+void* music_stream_worker(void *target)
+{
+ static_cast<Music_Stream*>(target)->prefetch_audio();
  return NULL;
 }
 
@@ -65,6 +131,32 @@ void Halt(const char *message)
  exit(EXIT_FAILURE);
 }
 
+unsigned short int pack_pixel(const unsigned short int red,const unsigned short int green,const unsigned short int blue)
+{
+ return (blue >> 3) +((green >> 2) << 5)+((red >> 3) << 11); // This code bases on code from SVGALib
+}
+
+size_t format_number(char *target,const unsigned long int value,const size_t digits)
+{
+ char buffer[NUMBER_LENGTH];
+ size_t length,index;
+ unsigned long int number;
+ number=value;
+ length=0;
+ do
+ {
+  buffer[length]='0'+static_cast<char>(number%10);
+  number/=10;
+  ++length;
+ } while ((number>0)||((length<digits)&&(length+1<NUMBER_LENGTH)));
+ for (index=0;index<length;++index)
+ {
+  target[index]=buffer[length-index-1];
+ }
+ target[length]=0;
+ return length;
+}
+
 Frame::Frame()
 {
  frame_width=0;
@@ -186,7 +278,21 @@ bool Frame::draw_pixel(const unsigned long int x,const unsigned long int y,const
  offset=static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(frame_width);
  if (offset<pixels)
  {
-  buffer[offset]=(blue >> 3) +((green >> 2) << 5)+((red >> 3) << 11); // This code bases on code from SVGALib
+  buffer[offset]=pack_pixel(red,green,blue);
+  result=true;
+ }
+ return result;
+}
+
+bool Frame::draw_pixel(const unsigned long int x,const unsigned long int y,const unsigned short int color)
+{
+ bool result;
+ size_t offset;
+ result=false;
+ offset=static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(frame_width);
+ if (offset<pixels)
+ {
+  buffer[offset]=color;
   result=true;
  }
  return result;
@@ -671,20 +777,40 @@ unsigned long int Memory::get_free_memory()
 
 Sound::Sound()
 {
- internal=NULL;
+ device=-1;
+ rate=0;
+ run=false;
+ policy=SCHED_OTHER;
+ priority=0;
+ ring=NULL;
+ lengths=NULL;
  buffer_length=0;
+ periods=SOUND_PERIODS;
+ head=0;
+ tail=0;
+ underruns=0;
+ overruns=0;
  stream=0;
+ pthread_mutex_init(&lock,NULL);
+ pthread_cond_init(&signal,NULL);
+ pthread_cond_init(&finished,NULL);
 }
 
 Sound::~Sound()
 {
- OSS_BACKEND::run_stream=false;
+ this->stop_stream();
+ if (ring!=NULL) free(ring);
+ if (lengths!=NULL) free(lengths);
+ if (device!=-1) close(device);
+ pthread_cond_destroy(&finished);
+ pthread_cond_destroy(&signal);
+ pthread_mutex_destroy(&lock);
 }
 
 void Sound::open_device()
 {
- OSS_BACKEND::sound_device=open("/dev/dsp",O_WRONLY,S_IRWXU|S_IRWXG|S_IRWXO);
- if (OSS_BACKEND::sound_device==-1)
+ device=open("/dev/dsp",O_WRONLY,S_IRWXU|S_IRWXG|S_IRWXO);
+ if (device==-1)
  {
   Halt("Can't get access to sound card");
  }
@@ -695,7 +821,7 @@ void Sound::set_format()
 {
  int format;
  format=AFMT_S16_LE;
- if (ioctl(OSS_BACKEND::sound_device,SNDCTL_DSP_SETFMT,&format)==-1)
+ if (ioctl(device,SNDCTL_DSP_SETFMT,&format)==-1)
  {
   Halt("Can't set sound format");
  }
@@ -706,16 +832,17 @@ void Sound::set_channels()
 {
  int channels;
  channels=SOUND_CHANNELS;
- if (ioctl(OSS_BACKEND::sound_device,SNDCTL_DSP_CHANNELS,&channels)==-1)
+ if (ioctl(device,SNDCTL_DSP_CHANNELS,&channels)==-1)
  {
   Halt("Can't set number of audio channels");
  }
 
 }
 
-void Sound::set_rate(const int rate)
+void Sound::set_rate(const int target)
 {
- if (ioctl(OSS_BACKEND::sound_device,SNDCTL_DSP_SPEED,&rate)==-1)
+ rate=target;
+ if (ioctl(device,SNDCTL_DSP_SPEED,&rate)==-1)
  {
   Halt("Can't set sample rate");
  }
@@ -726,11 +853,11 @@ void Sound::get_buffer_length()
 {
  audio_buf_info configuration;
  memset(&configuration,0,sizeof(audio_buf_info));
- if (ioctl(OSS_BACKEND::sound_device,SNDCTL_DSP_GETOSPACE,&configuration)==-1)
+ if (ioctl(device,SNDCTL_DSP_GETOSPACE,&configuration)==-1)
  {
   Halt("Can't read configuration of sound buffer");
  }
- buffer_length=static_cast<size_t>(configuration.fragstotal)*static_cast<size_t>(configuration.fragsize);
+ buffer_length=static_cast<size_t>(configuration.fragsize);
 }
 
 void Sound::configure_sound_card(const int rate)
@@ -744,33 +871,163 @@ void Sound::configure_sound_card(const int rate)
 
 void Sound::start_stream()
 {
- if (pthread_create(&stream,NULL,oss_play_sound,internal)!=0)
+ run=true;
+ if (pthread_create(&stream,NULL,sound_stream_worker,this)!=0)
  {
   Halt("Can't start sound stream");
  }
+ this->apply_scheduling();
+}
+
+void Sound::stop_stream()
+{
+ if (run==true)
+ {
+  pthread_mutex_lock(&lock);
+  run=false;
+  pthread_cond_signal(&signal);
+  pthread_cond_broadcast(&finished);
+  pthread_mutex_unlock(&lock);
+  pthread_join(stream,NULL);
+ }
+
+}
+
+void Sound::apply_scheduling()
+{
+ sched_param setting;
+ memset(&setting,0,sizeof(sched_param));
+ setting.sched_priority=priority;
+ if (pthread_setschedparam(stream,policy,&setting)!=0)
+ {
+  policy=SCHED_OTHER;
+  priority=0;
+ }
+
+}
+
+size_t Sound::get_distance(const size_t first,const size_t second) const
+{
+ return (first+2*periods-second)%(2*periods);
+}
+
+size_t Sound::get_next(const size_t counter) const
+{
+ size_t next;
+ next=counter+1;
+ if (next==2*periods) next=0;
+ return next;
+}
+
+void Sound::write_device(const char *buffer,const size_t length)
+{
+ size_t index;
+ ssize_t written;
+ index=0;
+ while (index<length)
+ {
+  written=write(device,buffer+index,length-index);
+  if (written>0)
+  {
+   index+=static_cast<size_t>(written);
+  }
+  else
+  {
+   if (errno!=EINTR) index=length;
+  }
+
+ }
 
 }
 
 void Sound::create_buffer()
 {
- internal=static_cast<char*>(calloc(buffer_length,sizeof(char)));
- if (internal==NULL)
+ ring=static_cast<char*>(calloc(periods*buffer_length,sizeof(char)));
+ if (ring==NULL)
  {
   Halt("Can't allocate memory for sound buffer");
  }
+ lengths=static_cast<size_t*>(calloc(periods,sizeof(size_t)));
+ if (lengths==NULL)
+ {
+  Halt("Can't allocate memory for sound buffer");
+ }
+
+}
+
+void Sound::set_periods(const size_t amount)
+{
+ if (run==false)
+ {
+  periods=amount;
+  if (periods<SOUND_MIN_PERIODS) periods=SOUND_MIN_PERIODS;
+ }
+
+}
+
+size_t Sound::get_periods() const
+{
+ return periods;
+}
+
+void Sound::set_scheduling(const int target_policy,const int target_priority)
+{
+ int minimum,maximum;
+ minimum=sched_get_priority_min(target_policy);
+ maximum=sched_get_priority_max(target_policy);
+ if ((minimum==-1)||(maximum==-1))
+ {
+  Halt("Invalid scheduling policy");
+ }
+ policy=target_policy;
+ priority=target_priority;
+ if (priority<minimum) priority=minimum;
+ if (priority>maximum) priority=maximum;
+ if (run==true) this->apply_scheduling();
+}
+
+int Sound::get_policy() const
+{
+ return policy;
+}
 
+int Sound::get_priority() const
+{
+ return priority;
 }
 
 void Sound::initialize(const int rate)
 {
- this->configure_sound_card(rate);
- this->create_buffer();
- this->start_stream();
+ if (run==false)
+ {
+  this->configure_sound_card(rate);
+  this->create_buffer();
+  this->start_stream();
+ }
+
+}
+
+int Sound::get_rate() const
+{
+ return rate;
 }
 
 bool Sound::check_busy()
 {
- return OSS_BACKEND::do_play;
+ bool result;
+ result=true;
+ if (run==true) result=(this->get_fill()==periods);
+ return result;
+}
+
+void Sound::wait()
+{
+ pthread_mutex_lock(&lock);
+ while ((this->get_fill()>0)&&(run==true))
+ {
+  pthread_cond_wait(&finished,&lock);
+ }
+ pthread_mutex_unlock(&lock);
 }
 
 size_t Sound::get_length() const
@@ -778,24 +1035,112 @@ size_t Sound::get_length() const
  return buffer_length;
 }
 
-size_t Sound::send(char *buffer,const size_t length)
+size_t Sound::get_fill() const
 {
- size_t amount;
- if (OSS_BACKEND::do_play)
+ return this->get_distance(load_counter(head),load_counter(tail));
+}
+
+unsigned long int Sound::get_underruns() const
+{
+ return static_cast<unsigned long int>(load_counter(underruns));
+}
+
+unsigned long int Sound::get_overruns() const
+{
+ return overruns;
+}
+
+char *Sound::acquire_period()
+{
+ size_t current;
+ char *period;
+ period=NULL;
+ if (run==true)
  {
-  amount=0;
+  current=load_counter(head);
+  if (this->get_distance(current,load_counter(tail))<periods)
+  {
+   period=ring+(current%periods)*buffer_length;
+  }
+  else
+  {
+   ++overruns;
+  }
+
  }
- else
+ return period;
+}
+
+void Sound::release_period(const size_t length)
+{
+ size_t current,slot;
+ if (run==true)
+ {
+  current=load_counter(head);
+  if (this->get_distance(current,load_counter(tail))<periods)
+  {
+   slot=current%periods;
+   lengths[slot]=buffer_length;
+   if (length<buffer_length) lengths[slot]=length;
+   store_counter(head,this->get_next(current));
+   pthread_mutex_lock(&lock);
+   pthread_cond_signal(&signal);
+   pthread_mutex_unlock(&lock);
+  }
+
+ }
+
+}
+
+size_t Sound::send(char *buffer,const size_t length)
+{
+ size_t amount;
+ char *period;
+ amount=0;
+ period=this->acquire_period();
+ if (period!=NULL)
  {
   amount=buffer_length;
   if (length<buffer_length) amount=length;
-  memmove(internal,buffer,amount);
-  OSS_BACKEND::sound_buffer_length=amount;
-  OSS_BACKEND::do_play=true;
+  memcpy(period,buffer,amount);
+  this->release_period(amount);
  }
  return amount;
 }
 
+void Sound::play_sound()
+{
+ size_t current,slot;
+ bool playing;
+ playing=false;
+ pthread_mutex_lock(&lock);
+ while (run==true)
+ {
+  current=load_counter(tail);
+  if (load_counter(head)==current)
+  {
+   if (playing==true)
+   {
+    store_counter(underruns,underruns+1);
+    playing=false;
+   }
+   pthread_cond_wait(&signal,&lock);
+  }
+  else
+  {
+   pthread_mutex_unlock(&lock);
+   slot=current%periods;
+   this->write_device(ring+slot*buffer_length,lengths[slot]);
+   store_counter(tail,this->get_next(current));
+   playing=true;
+   pthread_mutex_lock(&lock);
+   pthread_cond_broadcast(&finished);
+  }
+
+ }
+ pthread_mutex_unlock(&lock);
+}
+
 Sound* Sound::get_handle()
 {
  return this;
@@ -1136,12 +1481,36 @@ bool Binary_File::check_error()
 
 Input_File::Input_File()
 {
-
+ mapping=NULL;
+ mapping_length=0;
+ mapping_position=0;
+ mapping_heap=false;
+ mapping_view=false;
 }
 
 Input_File::~Input_File()
 {
+ this->clear_mapping();
+}
 
+void Input_File::clear_mapping()
+{
+ if (mapping!=NULL)
+ {
+  if (mapping_heap==true)
+  {
+   free(mapping);
+  }
+  else
+  {
+   if (mapping_view==false) munmap(mapping,mapping_length);
+  }
+  mapping=NULL;
+ }
+ mapping_length=0;
+ mapping_position=0;
+ mapping_heap=false;
+ mapping_view=false;
 }
 
 void Input_File::open(const char *name)
@@ -1150,1428 +1519,8581 @@ void Input_File::open(const char *name)
  this->open_file(name,"rb");
 }
 
-void Input_File::read(void *buffer,const size_t length)
-{
- fread(buffer,sizeof(char),length,target);
-}
-
-Output_File::Output_File()
+void Input_File::open_mapped(const char *name)
 {
+ int device;
+ struct stat info;
+ size_t index;
+ ssize_t amount;
+ void *memory;
+ this->close();
+ device=::open(name,O_RDONLY);
+ if (device==-1)
+ {
+  Halt("Can't open the binary file");
+ }
+ if (fstat(device,&info)==-1)
+ {
+  ::close(device);
+  Halt("Can't open the binary file");
+ }
+ mapping_length=static_cast<size_t>(info.st_size);
+ if (mapping_length>0)
+ {
+  memory=mmap(NULL,mapping_length,PROT_READ,MAP_PRIVATE,device,0);
+  if (memory!=MAP_FAILED)
+  {
+   mapping=static_cast<unsigned char*>(memory);
+  }
+  else
+  {
+   mapping=static_cast<unsigned char*>(malloc(mapping_length));
+   if (mapping==NULL)
+   {
+    ::close(device);
+    Halt("Can't allocate memory for file buffer");
+   }
+   mapping_heap=true;
+   for (index=0;index<mapping_length;index+=static_cast<size_t>(amount))
+   {
+    amount=::read(device,mapping+index,mapping_length-index);
+    if (amount<=0)
+    {
+     ::close(device);
+     Halt("Can't read the binary file");
+    }
 
-}
+   }
 
-Output_File::~Output_File()
-{
+  }
 
-}
+ }
+ else
+ {
+  mapping=static_cast<unsigned char*>(malloc(1));
+  mapping_heap=true;
+ }
+ ::close(device);
+ if (mapping==NULL)
+ {
+  Halt("Can't allocate memory for file buffer");
+ }
 
-void Output_File::open(const char *name)
-{
- this->close();
- this->open_file(name,"wb");
 }
 
-void Output_File::create_temp()
+void Input_File::open_memory(unsigned char *data,const size_t length,const bool owned)
 {
  this->close();
- target=tmpfile();
- if (target==NULL)
+ if (data==NULL)
  {
-  Halt("Can't create a temporary file");
+  Halt("Can't open the binary file");
  }
-
+ mapping=data;
+ mapping_length=length;
+ mapping_heap=owned;
+ mapping_view=!owned;
 }
 
-void Output_File::write(void *buffer,const size_t length)
+void Input_File::close()
 {
- fwrite(buffer,sizeof(char),length,target);
+ this->clear_mapping();
+ Binary_File::close();
 }
 
-void Output_File::flush()
+void Input_File::read(void *buffer,const size_t length)
 {
- fflush(target);
-}
+ size_t amount;
+ if (mapping!=NULL)
+ {
+  amount=length;
+  if (amount>mapping_length-mapping_position) amount=mapping_length-mapping_position;
+  memcpy(buffer,mapping+mapping_position,amount);
+  if (amount<length) memset(static_cast<char*>(buffer)+amount,0,length-amount);
+  mapping_position+=amount;
+ }
+ else
+ {
+  fread(buffer,sizeof(char),length,target);
+ }
 
-Audio::Audio()
-{
- memset(&head,0,44);
 }
 
-Audio::~Audio()
+void Input_File::set_position(const long int offset)
 {
+ if (mapping!=NULL)
+ {
+  mapping_position=mapping_length;
+  if ((offset>=0)&&(static_cast<size_t>(offset)<mapping_length)) mapping_position=offset;
+ }
+ else
+ {
+  Binary_File::set_position(offset);
+ }
 
 }
 
-void Audio::read_head()
-{
- target.read(&head,44);
-}
-
-void Audio::check_riff_signature()
+long int Input_File::get_position()
 {
- if (strncmp(head.riff_signature,"RIFF",4)!=0)
+ long int result;
+ if (mapping!=NULL)
  {
-  Halt("Incorrect riff signature");
+  result=mapping_position;
  }
-
+ else
+ {
+  result=Binary_File::get_position();
+ }
+ return result;
 }
 
-void Audio::check_wave_signature()
+long int Input_File::get_length()
 {
- if (strncmp(head.wave_signature,"WAVE",4)!=0)
+ long int result;
+ if (mapping!=NULL)
  {
-  Halt("Incorrect wave signature");
+  result=mapping_length;
  }
-
+ else
+ {
+  result=Binary_File::get_length();
+ }
+ return result;
 }
 
-void Audio::check_type() const
+bool Input_File::check_error()
 {
- if (head.type!=1)
- {
-  Halt("Incorrect type of wave file");
- }
+ bool result;
+ result=false;
+ if (mapping==NULL) result=Binary_File::check_error();
+ return result;
+}
 
+bool Input_File::check_mapped() const
+{
+ return mapping!=NULL;
 }
 
-void Audio::check_bits() const
+const unsigned char *Input_File::get_view(const size_t offset,const size_t length) const
 {
- if (head.bits!=16)
+ const unsigned char *result;
+ result=NULL;
+ if ((mapping!=NULL)&&(offset<=mapping_length))
  {
-  Halt("Incorrect amount of sound bits");
+  if (length<=mapping_length-offset) result=mapping+offset;
  }
-
+ return result;
 }
 
-void Audio::check_channels() const
+void Input_File::preload()
 {
- if ((head.channels==0)||(head.channels>2))
+ size_t index;
+ volatile unsigned char value;
+ if ((mapping!=NULL)&&(mapping_heap==false)&&(mapping_length>0))
  {
-  Halt("Incorrect number of audio channels");
+  if (mapping_view==false) madvise(mapping,mapping_length,MADV_WILLNEED);
+  for (index=0;index<mapping_length;index+=LOAD_PAGE)
+  {
+   value=mapping[index];
+  }
+  value=mapping[mapping_length-1];
+  (void)value;
  }
 
 }
 
-void Audio::check_wave()
+Pack_File::Pack_File()
 {
- this->check_riff_signature();
- this->check_wave_signature();
- this->check_type();
- this->check_bits();
- this->check_channels();
+ index=NULL;
+ amount=0;
 }
 
-Audio* Audio::get_handle()
+Pack_File::~Pack_File()
 {
- return this;
+ this->close();
 }
 
-size_t Audio::get_total() const
+size_t Pack_File::find_entry(const char *name) const
 {
- return static_cast<size_t>(head.date_length);
-}
+ size_t result,low,high,middle;
+ int order;
+ result=PACK_NONE;
+ low=0;
+ high=amount;
+ while (low<high)
+ {
+  middle=low+(high-low)/2;
+  order=strncmp(index[middle].name,name,sizeof(index[middle].name));
+  if (order==0)
+  {
+   if (strlen(name)<sizeof(index[middle].name)) result=middle;
+   break;
+  }
+  if (order<0)
+  {
+   low=middle+1;
+  }
+  else
+  {
+   high=middle;
+  }
 
-size_t Audio::get_block() const
-{
- return static_cast<size_t>(head.block_length);
+ }
+ return result;
 }
 
-unsigned long int Audio::get_rate() const
+size_t Pack_File::read_length(const unsigned char *&source,const unsigned char *stop) const
 {
- return head.rate;
+ size_t result;
+ unsigned char part;
+ result=0;
+ do
+ {
+  if (source>=stop)
+  {
+   result=PACK_NONE;
+   break;
+  }
+  part=*source;
+  ++source;
+  result+=part;
+ } while (part==255);
+ return result;
 }
 
-unsigned short int Audio::get_channels() const
+unsigned char *Pack_File::decompress_entry(const PAK_Entry &entry) const
 {
- return head.channels;
+ const unsigned char *source;
+ const unsigned char *stop;
+ unsigned char *target;
+ unsigned char token;
+ size_t position,length,offset,extra,step;
+ bool complete;
+ source=pack.get_view(entry.offset,entry.length);
+ target=static_cast<unsigned char*>(malloc(static_cast<size_t>(entry.size)+1));
+ if (target==NULL)
+ {
+  Halt("Can't allocate memory for pack entry");
+ }
+ stop=source+entry.length;
+ position=0;
+ complete=false;
+ while (source<stop)
+ {
+  token=*source;
+  ++source;
+  length=token>>4;
+  if (length==15)
+  {
+   extra=this->read_length(source,stop);
+   if (extra==PACK_NONE) break;
+   length+=extra;
+  }
+  if ((length>static_cast<size_t>(stop-source))||(length>entry.size-position)) break;
+  memcpy(target+position,source,length);
+  position+=length;
+  source+=length;
+  if (source==stop)
+  {
+   complete=position==entry.size;
+   break;
+  }
+  if (stop-source<2) break;
+  offset=source[0]|(source[1]<<8);
+  source+=2;
+  if ((offset==0)||(offset>position)) break;
+  length=token&15;
+  if (length==15)
+  {
+   extra=this->read_length(source,stop);
+   if (extra==PACK_NONE) break;
+   length+=extra;
+  }
+  length+=PACK_MIN_MATCH;
+  if (length>entry.size-position) break;
+  if (offset>=length)
+  {
+   memcpy(target+position,target+position-offset,length);
+  }
+  else
+  {
+   for (step=0;step<length;++step) target[position+step]=target[position+step-offset];
+  }
+  position+=length;
+ }
+ if (complete==false)
+ {
+  free(target);
+  Halt("Incorrect pack format");
+ }
+ return target;
 }
 
-unsigned short int Audio::get_bits() const
+void Pack_File::open(const char *name)
 {
- return head.bits;
+ PAK_head head;
+ const unsigned char *source;
+ size_t entry;
+ this->close();
+ pack.open_mapped(name);
+ source=pack.get_view(0,PACK_HEAD_LENGTH);
+ if (source==NULL)
+ {
+  Halt("Incorrect pack format");
+ }
+ memcpy(&head,source,PACK_HEAD_LENGTH);
+ if (strncmp(head.signature,"DPAK",4)!=0)
+ {
+  Halt("Incorrect pack format");
+ }
+ amount=head.amount;
+ index=reinterpret_cast<const PAK_Entry*>(pack.get_view(PACK_HEAD_LENGTH,amount*PACK_ENTRY_LENGTH));
+ if ((index==NULL)||(amount>pack.get_length()/PACK_ENTRY_LENGTH))
+ {
+  Halt("Incorrect pack format");
+ }
+ for (entry=0;entry<amount;++entry)
+ {
+  if ((pack.get_view(index[entry].offset,index[entry].length)==NULL)||(index[entry].offset%PACK_ALIGN!=0))
+  {
+   Halt("Incorrect pack format");
+  }
+  if ((index[entry].flags&PACK_COMPRESSED)==0)
+  {
+   if (index[entry].length!=index[entry].size) Halt("Incorrect pack format");
+  }
+  if (index[entry].name[sizeof(index[entry].name)-1]!=0)
+  {
+   Halt("Incorrect pack format");
+  }
+  if (entry>0)
+  {
+   if (strcmp(index[entry-1].name,index[entry].name)>=0) Halt("Incorrect pack format");
+  }
+
+ }
+
 }
 
-void Audio::load_wave(const char *name)
+void Pack_File::close()
 {
- target.open(name);
- this->read_head();
- this->check_wave();
+ pack.close();
+ index=NULL;
+ amount=0;
 }
 
-void Audio::read_data(void *buffer,const size_t length)
+size_t Pack_File::get_amount() const
 {
- target.read(buffer,length);
+ return amount;
 }
 
-void Audio::go_start()
+const char *Pack_File::get_name(const size_t entry) const
 {
- target.set_position(44);
+ const char *result;
+ result=NULL;
+ if (entry<amount) result=index[entry].name;
+ return result;
 }
 
-Player::Player()
+size_t Pack_File::get_size(const size_t entry) const
 {
- sound=NULL;
- target=NULL;
- buffer=NULL;
- index=0;
- length=0;
+ size_t result;
+ result=0;
+ if (entry<amount) result=index[entry].size;
+ return result;
 }
 
-Player::~Player()
+bool Pack_File::check_compressed(const size_t entry) const
 {
- if (buffer!=NULL) delete[] buffer;
+ bool result;
+ result=false;
+ if (entry<amount) result=(index[entry].flags&PACK_COMPRESSED)!=0;
+ return result;
 }
 
-void Player::configure_player(Audio *audio)
+bool Pack_File::check_entry(const char *name) const
 {
- index=0;
- target=audio;
- length=target->get_total();
+ return this->find_entry(name)!=PACK_NONE;
 }
 
-void Player::clear_buffer()
+void Pack_File::open_entry(const char *name,Input_File &target)
 {
- if (buffer!=NULL)
+ size_t entry;
+ const unsigned char *source;
+ entry=this->find_entry(name);
+ if (entry==PACK_NONE)
  {
-  delete[] buffer;
-  buffer=NULL;
+  Halt("Can't find the pack entry");
  }
-
-}
-
-void Player::create_buffer()
-{
- try
+ if ((index[entry].flags&PACK_COMPRESSED)!=0)
  {
-  buffer=new char[sound->get_length()];
+  target.open_memory(this->decompress_entry(index[entry]),index[entry].size,true);
  }
- catch (...)
+ else
  {
-  Halt("Can't allocate memory for audio buffer");
+  source=pack.get_view(index[entry].offset,index[entry].length);
+  target.open_memory(const_cast<unsigned char*>(source),index[entry].length,false);
  }
 
 }
 
-void Player::rewind_audio()
+Pack_File* Pack_File::get_handle()
 {
- index=0;
- target->go_start();
+ return this;
 }
 
-bool Player::is_end() const
+Pack_Writer::Pack_Writer()
 {
- bool end_audio;
- end_audio=false;
- if (index==length)
- {
-  end_audio=true;
- }
- return end_audio;
+ entries=NULL;
+ paths=NULL;
+ amount=0;
+ limit=0;
+ position=0;
 }
 
-void Player::load(Audio *audio)
+Pack_Writer::~Pack_Writer()
 {
- this->configure_player(audio);
- this->clear_buffer();
- this->create_buffer();
+ this->clear_entries();
 }
 
-void Player::initialize(Sound *target)
+void Pack_Writer::clear_entries()
 {
- sound=target;
+ size_t entry;
+ if (paths!=NULL)
+ {
+  for (entry=0;entry<amount;++entry)
+  {
+   free(paths[entry]);
+  }
+  free(paths);
+  paths=NULL;
+ }
+ if (entries!=NULL)
+ {
+  free(entries);
+  entries=NULL;
+ }
+ amount=0;
+ limit=0;
+ position=0;
 }
 
-void Player::play()
+void Pack_Writer::sort_entries()
 {
- size_t block;
- size_t elapsed;
- block=sound->get_length();
- if (index<length)
+ size_t entry,previous;
+ PAK_Entry current;
+ char *path;
+ for (entry=1;entry<amount;++entry)
+ {
+  current=entries[entry];
+  path=paths[entry];
+  for (previous=entry;previous>0;--previous)
+  {
+   if (strcmp(entries[previous-1].name,current.name)<=0) break;
+   entries[previous]=entries[previous-1];
+   paths[previous]=paths[previous-1];
+  }
+  entries[previous]=current;
+  paths[previous]=path;
+ }
+ for (entry=1;entry<amount;++entry)
  {
-  if (sound->check_busy()==false)
+  if (strcmp(entries[entry-1].name,entries[entry].name)==0)
   {
-   elapsed=length-index;
-   if (block>elapsed) block=elapsed;
-   target->read_data(buffer,block);
-   index+=sound->send(buffer,block);
+   Halt("Duplicate pack entry name");
   }
 
  }
 
 }
 
-void Player::loop()
+unsigned char *Pack_Writer::read_source(const char *path,size_t &length)
 {
- if (this->is_end())
- {
-  this->rewind_audio();
- }
- else
+ Input_File source;
+ unsigned char *result;
+ source.open_mapped(path);
+ length=source.get_length();
+ result=static_cast<unsigned char*>(malloc(length+1));
+ if (result==NULL)
  {
-  this->play();
+  Halt("Can't allocate memory for pack entry");
  }
-
+ source.read(result,length);
+ source.close();
+ return result;
 }
 
-Primitive::Primitive()
+size_t Pack_Writer::write_length(unsigned char *output,size_t length) const
 {
- surface=NULL;
- color.red=0;
- color.green=0;
- color.blue=0;
+ size_t result;
+ result=0;
+ while (length>=255)
+ {
+  output[result]=255;
+  ++result;
+  length-=255;
+ }
+ output[result]=static_cast<unsigned char>(length);
+ return result+1;
+}
+
+size_t Pack_Writer::write_sequence(unsigned char *output,const unsigned char *literals,const size_t literal_length,const size_t offset,const size_t match) const
+{
+ size_t result;
+ unsigned char token;
+ token=(literal_length<15 ? literal_length:15)<<4;
+ if (match>=PACK_MIN_MATCH) token|=(match-PACK_MIN_MATCH<15 ? match-PACK_MIN_MATCH:15);
+ output[0]=token;
+ result=1;
+ if (literal_length>=15) result+=this->write_length(output+result,literal_length-15);
+ memcpy(output+result,literals,literal_length);
+ result+=literal_length;
+ if (match>=PACK_MIN_MATCH)
+ {
+  output[result]=offset&255;
+  output[result+1]=(offset>>8)&255;
+  result+=2;
+  if (match-PACK_MIN_MATCH>=15) result+=this->write_length(output+result,match-PACK_MIN_MATCH-15);
+ }
+ return result;
 }
 
-Primitive::~Primitive()
+size_t Pack_Writer::compress_data(const unsigned char *source,const size_t length,unsigned char *output) const
 {
+ size_t *table;
+ size_t result,position,anchor,candidate,match,hash;
+ unsigned long int value;
+ table=static_cast<size_t*>(calloc(static_cast<size_t>(1)<<PACK_HASH_BITS,sizeof(size_t)));
+ if (table==NULL)
+ {
+  Halt("Can't allocate memory for pack compressor");
+ }
+ result=0;
+ position=0;
+ anchor=0;
+ while (position+PACK_MIN_MATCH+PACK_LAST_LITERALS<=length)
+ {
+  value=source[position]|(source[position+1]<<8)|(source[position+2]<<16)|(static_cast<unsigned long int>(source[position+3])<<24);
+  hash=((value*2654435761UL)&0xFFFFFFFFUL)>>(32-PACK_HASH_BITS);
+  candidate=table[hash];
+  table[hash]=position+1;
+  if (candidate!=0)
+  {
+   --candidate;
+   if ((position-candidate<=PACK_MAX_OFFSET)&&(memcmp(source+candidate,source+position,PACK_MIN_MATCH)==0))
+   {
+    match=PACK_MIN_MATCH;
+    while ((position+match+PACK_LAST_LITERALS<length)&&(source[candidate+match]==source[position+match])) ++match;
+    result+=this->write_sequence(output+result,source+anchor,position-anchor,position-candidate,match);
+    position+=match;
+    anchor=position;
+    continue;
+   }
 
+  }
+  ++position;
+ }
+ result+=this->write_sequence(output+result,source+anchor,length-anchor,0,0);
+ free(table);
+ return result;
 }
 
-void Primitive::initialize(Screen *screen)
+void Pack_Writer::write_padding()
 {
- surface=screen;
+ unsigned char padding[PACK_ALIGN];
+ memset(padding,0,PACK_ALIGN);
+ if (position%PACK_ALIGN!=0)
+ {
+  target.write(padding,PACK_ALIGN-position%PACK_ALIGN);
+  position+=PACK_ALIGN-position%PACK_ALIGN;
+ }
+
 }
 
-void Primitive::set_color(const unsigned char red,const unsigned char green,const unsigned char blue)
+void Pack_Writer::create(const char *name)
 {
- color.red=red;
- color.green=green;
- color.blue=blue;
+ this->clear_entries();
+ target.open(name);
 }
 
-void Primitive::draw_line(const unsigned long int x1,const unsigned long int y1,const unsigned long int x2,const unsigned long int y2)
+void Pack_Writer::add_file(const char *name,const char *path,const bool compress)
 {
- unsigned long int delta_x,delta_y,index,steps;
- float x,y,shift_x,shift_y;
- if (x1>x2)
- {
-  delta_x=x1-x2;
- }
- else
+ size_t length;
+ length=strlen(name);
+ if ((length==0)||(length>=sizeof(entries[0].name)))
  {
-  delta_x=x2-x1;
+  Halt("Incorrect pack entry name");
  }
- if (y1>y2)
+ if (amount==limit)
  {
-  delta_y=y1-y2;
+  limit+=8;
+  entries=static_cast<PAK_Entry*>(realloc(entries,limit*sizeof(PAK_Entry)));
+  paths=static_cast<char**>(realloc(paths,limit*sizeof(char*)));
+  if ((entries==NULL)||(paths==NULL))
+  {
+   Halt("Can't allocate memory for pack index");
+  }
+
  }
- else
+ memset(entries+amount,0,sizeof(PAK_Entry));
+ memcpy(entries[amount].name,name,length);
+ if (compress==true) entries[amount].flags=PACK_COMPRESSED;
+ paths[amount]=static_cast<char*>(malloc(strlen(path)+1));
+ if (paths[amount]==NULL)
  {
-  delta_y=y2-y1;
+  Halt("Can't allocate memory for pack index");
  }
- steps=delta_x;
- if (steps<delta_y) steps=delta_y;
- x=x1;
- y=y1;
- shift_x=static_cast<float>(delta_x)/static_cast<float>(steps);
- shift_y=static_cast<float>(delta_y)/static_cast<float>(steps);
- for (index=steps;index>0;--index)
+ strcpy(paths[amount],path);
+ ++amount;
+}
+
+void Pack_Writer::close()
+{
+ PAK_head head;
+ unsigned char *data;
+ unsigned char *output;
+ size_t entry,length,packed;
+ this->sort_entries();
+ memset(&head,0,sizeof(PAK_head));
+ memcpy(head.signature,"DPAK",4);
+ head.amount=amount;
+ target.write(&head,PACK_HEAD_LENGTH);
+ position=PACK_HEAD_LENGTH;
+ if (amount>0) target.write(entries,amount*PACK_ENTRY_LENGTH);
+ position+=amount*PACK_ENTRY_LENGTH;
+ for (entry=0;entry<amount;++entry)
  {
-  x+=shift_x;
-  y+=shift_y;
-  surface->draw_pixel(x,y,color.red,color.green,color.blue);
- }
+  data=this->read_source(paths[entry],length);
+  entries[entry].size=length;
+  entries[entry].length=length;
+  if (((entries[entry].flags&PACK_COMPRESSED)!=0)&&(length>0))
+  {
+   output=static_cast<unsigned char*>(malloc(length+length/255+16));
+   if (output==NULL)
+   {
+    Halt("Can't allocate memory for pack compressor");
+   }
+   packed=this->compress_data(data,length,output);
+   if (packed<length)
+   {
+    free(data);
+    data=output;
+    entries[entry].length=packed;
+   }
+   else
+   {
+    free(output);
+   }
 
+  }
+  if (entries[entry].length==entries[entry].size) entries[entry].flags&=~PACK_COMPRESSED;
+  this->write_padding();
+  entries[entry].offset=position;
+  target.write(data,entries[entry].length);
+  position+=entries[entry].length;
+  free(data);
+ }
+ target.set_position(PACK_HEAD_LENGTH);
+ if (amount>0) target.write(entries,amount*PACK_ENTRY_LENGTH);
+ target.close();
+ this->clear_entries();
 }
 
-void Primitive::draw_rectangle(const unsigned long int x,const unsigned long int y,const unsigned long int width,const unsigned long int height)
+Output_File::Output_File()
 {
- unsigned long int stop_x,stop_y;
- stop_x=x+width;
- stop_y=y+height;
- this->draw_line(x,y,stop_x,y);
- this->draw_line(x,stop_y,stop_x,stop_y);
- this->draw_line(x,y,x,stop_y);
- this->draw_line(stop_x,y,stop_x,stop_y);
+
 }
 
-void Primitive::draw_filled_rectangle(const unsigned long int x,const unsigned long int y,const unsigned long int width,const unsigned long int height)
+Output_File::~Output_File()
 {
- unsigned long int step_x,step_y,stop_x,stop_y;
- stop_x=x+width;
- stop_y=y+height;
- for (step_x=x;step_x<stop_x;++step_x)
- {
-  for (step_y=y;step_y<stop_y;++step_y)
-  {
-   surface->draw_pixel(step_x,step_y,color.red,color.green,color.blue);
-  }
-
- }
 
 }
 
-Image::Image()
+void Output_File::open(const char *name)
 {
- width=0;
- height=0;
- data=NULL;
+ this->close();
+ this->open_file(name,"wb");
+}
+
+void Output_File::create_temp()
+{
+ this->close();
+ target=tmpfile();
+ if (target==NULL)
+ {
+  Halt("Can't create a temporary file");
+ }
+
+}
+
+void Output_File::write(void *buffer,const size_t length)
+{
+ fwrite(buffer,sizeof(char),length,target);
+}
+
+void Output_File::flush()
+{
+ fflush(target);
+}
+
+Audio::Audio()
+{
+ memset(&head,0,44);
+}
+
+Audio::~Audio()
+{
+
+}
+
+void Audio::read_head()
+{
+ target.read(&head,44);
+}
+
+void Audio::check_riff_signature()
+{
+ if (strncmp(head.riff_signature,"RIFF",4)!=0)
+ {
+  Halt("Incorrect riff signature");
+ }
+
+}
+
+void Audio::check_wave_signature()
+{
+ if (strncmp(head.wave_signature,"WAVE",4)!=0)
+ {
+  Halt("Incorrect wave signature");
+ }
+
+}
+
+void Audio::check_type() const
+{
+ if (head.type!=1)
+ {
+  Halt("Incorrect type of wave file");
+ }
+
+}
+
+void Audio::check_bits() const
+{
+ if (head.bits!=16)
+ {
+  Halt("Incorrect amount of sound bits");
+ }
+
+}
+
+void Audio::check_channels() const
+{
+ if ((head.channels==0)||(head.channels>2))
+ {
+  Halt("Incorrect number of audio channels");
+ }
+
+}
+
+void Audio::check_wave()
+{
+ this->check_riff_signature();
+ this->check_wave_signature();
+ this->check_type();
+ this->check_bits();
+ this->check_channels();
+}
+
+Audio* Audio::get_handle()
+{
+ return this;
+}
+
+size_t Audio::get_total() const
+{
+ return static_cast<size_t>(head.date_length);
+}
+
+size_t Audio::get_block() const
+{
+ return static_cast<size_t>(head.block_length);
+}
+
+unsigned long int Audio::get_rate() const
+{
+ return head.rate;
+}
+
+unsigned short int Audio::get_channels() const
+{
+ return head.channels;
+}
+
+unsigned short int Audio::get_bits() const
+{
+ return head.bits;
+}
+
+void Audio::load_wave(const char *name)
+{
+ target.open_mapped(name);
+ this->read_head();
+ this->check_wave();
+}
+
+void Audio::load_wave(Pack_File &pack,const char *name)
+{
+ pack.open_entry(name,target);
+ this->read_head();
+ this->check_wave();
+}
+
+void Audio::read_data(void *buffer,const size_t length)
+{
+ target.read(buffer,length);
+}
+
+void Audio::read_data(void *buffer,const size_t offset,const size_t length)
+{
+ target.set_position(44+static_cast<long int>(offset));
+ target.read(buffer,length);
+}
+
+const unsigned char *Audio::get_view(const size_t offset,const size_t length) const
+{
+ return target.get_view(44+offset,length);
+}
+
+void Audio::go_start()
+{
+ target.set_position(44);
+}
+
+Player::Player()
+{
+ sound=NULL;
+ target=NULL;
+ index=0;
+ length=0;
+}
+
+Player::~Player()
+{
+
+}
+
+void Player::configure_player(Audio *audio)
+{
+ index=0;
+ target=audio;
+ length=target->get_total();
+}
+
+void Player::rewind_audio()
+{
+ index=0;
+ target->go_start();
+}
+
+bool Player::is_end() const
+{
+ bool end_audio;
+ end_audio=false;
+ if (index==length)
+ {
+  end_audio=true;
+ }
+ return end_audio;
+}
+
+void Player::load(Audio *audio)
+{
+ this->configure_player(audio);
+}
+
+void Player::initialize(Sound *target)
+{
+ sound=target;
+}
+
+void Player::play()
+{
+ size_t block;
+ char *period;
+ while ((index<length)&&(sound->check_busy()==false))
+ {
+  block=sound->get_length();
+  if (block>length-index) block=length-index;
+  period=sound->acquire_period();
+  target->read_data(period,block);
+  sound->release_period(block);
+  index+=block;
+ }
+
+}
+
+void Player::loop()
+{
+ if (this->is_end())
+ {
+  this->rewind_audio();
+ }
+ else
+ {
+  this->play();
+ }
+
+}
+
+Music_Stream::Music_Stream()
+{
+ sound=NULL;
+ run=false;
+ looping=true;
+ finished=true;
+ stream=0;
+ pthread_mutex_init(&lock,NULL);
+ pthread_cond_init(&signal,NULL);
+ ring=NULL;
+ lengths=NULL;
+ periods=MUSIC_PERIODS;
+ period_length=0;
+ frame_length=0;
+ head=0;
+ tail=0;
+ offset=0;
+ position=0;
+ total=0;
+ loop_start=0;
+ loop_end=0;
+ underruns=0;
+}
+
+Music_Stream::~Music_Stream()
+{
+ this->close();
+ pthread_cond_destroy(&signal);
+ pthread_mutex_destroy(&lock);
+}
+
+size_t Music_Stream::get_distance(const size_t first,const size_t second) const
+{
+ return (first+2*periods-second)%(2*periods);
+}
+
+size_t Music_Stream::get_next(const size_t counter) const
+{
+ size_t next;
+ next=counter+1;
+ if (next==2*periods) next=0;
+ return next;
+}
+
+void Music_Stream::get_loop(size_t &start,size_t &end) const
+{
+ end=loop_end;
+ if ((end==0)||(end>total)) end=total;
+ start=loop_start;
+ if (start>=end) start=0;
+}
+
+void Music_Stream::create_buffer()
+{
+ ring=static_cast<char*>(calloc(periods*period_length,sizeof(char)));
+ if (ring==NULL)
+ {
+  Halt("Can't allocate memory for music buffer");
+ }
+ lengths=static_cast<size_t*>(calloc(periods,sizeof(size_t)));
+ if (lengths==NULL)
+ {
+  Halt("Can't allocate memory for music buffer");
+ }
+
+}
+
+void Music_Stream::clear_buffer()
+{
+ if (ring!=NULL)
+ {
+  free(ring);
+  ring=NULL;
+ }
+ if (lengths!=NULL)
+ {
+  free(lengths);
+  lengths=NULL;
+ }
+
+}
+
+void Music_Stream::configure_stream()
+{
+ frame_length=static_cast<size_t>(audio.get_channels())*sizeof(short int);
+ period_length=MUSIC_FRAMES*frame_length;
+ total=audio.get_total()/frame_length;
+ head=0;
+ tail=0;
+ offset=0;
+ position=0;
+ underruns=0;
+ finished=(total==0);
+}
+
+void Music_Stream::start_stream()
+{
+ run=true;
+ if (pthread_create(&stream,NULL,music_stream_worker,this)!=0)
+ {
+  Halt("Can't start music stream");
+ }
+
+}
+
+void Music_Stream::stop_stream()
+{
+ if (run==true)
+ {
+  pthread_mutex_lock(&lock);
+  run=false;
+  pthread_cond_signal(&signal);
+  pthread_mutex_unlock(&lock);
+  pthread_join(stream,NULL);
+ }
+
+}
+
+bool Music_Stream::fill_period(const size_t start,const size_t end,const bool loop)
+{
+ size_t slot,current,filled,amount;
+ bool ended;
+ current=load_counter(head);
+ slot=current%periods;
+ filled=0;
+ ended=false;
+ while ((filled<MUSIC_FRAMES)&&(ended==false))
+ {
+  if (position>=end)
+  {
+   position=start;
+   ended=!loop;
+  }
+  else
+  {
+   amount=end-position;
+   if (amount>MUSIC_FRAMES-filled) amount=MUSIC_FRAMES-filled;
+   audio.read_data(ring+slot*period_length+filled*frame_length,position*frame_length,amount*frame_length);
+   filled+=amount;
+   position+=amount;
+  }
+
+ }
+ if (filled>0)
+ {
+  lengths[slot]=filled*frame_length;
+  store_counter(head,this->get_next(current));
+ }
+ return ended;
+}
+
+void Music_Stream::copy_frames(short int *target,const char *source,const size_t amount) const
+{
+ size_t index;
+ const short int *data;
+ if (frame_length==SOUND_CHANNELS*sizeof(short int))
+ {
+  memcpy(target,source,amount*frame_length);
+ }
+ else
+ {
+  data=reinterpret_cast<const short int*>(source);
+  for (index=0;index<amount;++index)
+  {
+   target[2*index]=data[index];
+   target[2*index+1]=data[index];
+  }
+
+ }
+
+}
+
+void Music_Stream::check_rate() const
+{
+ if ((sound!=NULL)&&(total>0))
+ {
+  if (audio.get_rate()!=static_cast<unsigned long int>(sound->get_rate()))
+  {
+   Halt("Music rate doesn't match the sound rate");
+  }
+
+ }
+
+}
+
+void Music_Stream::set_prefetch(const size_t amount)
+{
+ if (run==false)
+ {
+  periods=amount;
+  if (periods<MUSIC_MIN_PERIODS) periods=MUSIC_MIN_PERIODS;
+ }
+
+}
+
+size_t Music_Stream::get_prefetch() const
+{
+ return periods;
+}
+
+void Music_Stream::open(const char *name)
+{
+ this->close();
+ audio.load_wave(name);
+ this->configure_stream();
+ this->check_rate();
+ this->create_buffer();
+ this->start_stream();
+}
+
+void Music_Stream::open(Pack_File &pack,const char *name)
+{
+ this->close();
+ audio.load_wave(pack,name);
+ this->configure_stream();
+ this->check_rate();
+ this->create_buffer();
+ this->start_stream();
+}
+
+void Music_Stream::close()
+{
+ this->stop_stream();
+ this->clear_buffer();
+ head=0;
+ tail=0;
+ offset=0;
+ total=0;
+ finished=true;
+}
+
+void Music_Stream::set_loop(const size_t start,const size_t end)
+{
+ pthread_mutex_lock(&lock);
+ loop_start=start;
+ loop_end=end;
+ pthread_mutex_unlock(&lock);
+}
+
+size_t Music_Stream::get_loop_start() const
+{
+ return loop_start;
+}
+
+size_t Music_Stream::get_loop_end() const
+{
+ return loop_end;
+}
+
+void Music_Stream::set_looping(const bool enabled)
+{
+ pthread_mutex_lock(&lock);
+ looping=enabled;
+ if ((looping==true)&&(total>0)) finished=false;
+ pthread_cond_signal(&signal);
+ pthread_mutex_unlock(&lock);
+}
+
+bool Music_Stream::get_looping() const
+{
+ return looping;
+}
+
+unsigned long int Music_Stream::get_rate() const
+{
+ return audio.get_rate();
+}
+
+size_t Music_Stream::get_length() const
+{
+ return total;
+}
+
+size_t Music_Stream::get_fill() const
+{
+ return this->get_distance(load_counter(head),load_counter(tail));
+}
+
+unsigned long int Music_Stream::get_underruns() const
+{
+ return underruns;
+}
+
+bool Music_Stream::is_end()
+{
+ bool end_audio;
+ pthread_mutex_lock(&lock);
+ end_audio=((finished==true)&&(this->get_fill()==0));
+ pthread_mutex_unlock(&lock);
+ return end_audio;
+}
+
+size_t Music_Stream::read(short int *target,const size_t amount)
+{
+ size_t done,block,slot,current;
+ done=0;
+ if (ring!=NULL)
+ {
+  current=load_counter(tail);
+  while ((done<amount)&&(load_counter(head)!=current))
+  {
+   slot=current%periods;
+   block=(lengths[slot]-offset)/frame_length;
+   if (block>amount-done) block=amount-done;
+   this->copy_frames(target+done*SOUND_CHANNELS,ring+slot*period_length+offset,block);
+   done+=block;
+   offset+=block*frame_length;
+   if (offset==lengths[slot])
+   {
+    offset=0;
+    current=this->get_next(current);
+    store_counter(tail,current);
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&signal);
+    pthread_mutex_unlock(&lock);
+   }
+
+  }
+  if (done<amount)
+  {
+   if (this->is_end()==false) ++underruns;
+  }
+
+ }
+ return done;
+}
+
+void Music_Stream::initialize(Sound *target)
+{
+ sound=target;
+ this->check_rate();
+}
+
+void Music_Stream::update()
+{
+ size_t amount;
+ char *period;
+ if (sound==NULL)
+ {
+  Halt("Music stream isn't initialized");
+ }
+ amount=1;
+ while ((amount>0)&&(sound->check_busy()==false))
+ {
+  period=sound->acquire_period();
+  amount=this->read(reinterpret_cast<short int*>(period),sound->get_length()/MIXER_FRAME);
+  if (amount>0) sound->release_period(amount*MIXER_FRAME);
+ }
+
+}
+
+void Music_Stream::prefetch_audio()
+{
+ size_t start,end;
+ bool loop,ended;
+ pthread_mutex_lock(&lock);
+ while (run==true)
+ {
+  if ((finished==true)||(this->get_distance(load_counter(head),load_counter(tail))==periods))
+  {
+   pthread_cond_wait(&signal,&lock);
+  }
+  else
+  {
+   this->get_loop(start,end);
+   loop=looping;
+   if (loop==false) end=total;
+   pthread_mutex_unlock(&lock);
+   ended=this->fill_period(start,end,loop);
+   pthread_mutex_lock(&lock);
+   if ((ended==true)&&(looping==false)) finished=true;
+  }
+
+ }
+ pthread_mutex_unlock(&lock);
+}
+
+Music_Stream* Music_Stream::get_handle()
+{
+ return this;
+}
+
+Sound_Mixer::Sound_Mixer()
+{
+ sound=NULL;
+ music=NULL;
+ voices=NULL;
+ accumulator=NULL;
+ samples=NULL;
+ input=NULL;
+ voice_amount=MIXER_VOICES;
+ frames=0;
+ stamp=0;
+ master=MIXER_UNITY;
+ music_volume=MIXER_UNITY;
+}
+
+Sound_Mixer::~Sound_Mixer()
+{
+ if (voices!=NULL) free(voices);
+ if (accumulator!=NULL) free(accumulator);
+ if (samples!=NULL) free(samples);
+ if (input!=NULL) free(input);
+}
+
+void Sound_Mixer::create_buffers()
+{
+ voices=static_cast<MIX_Voice*>(calloc(voice_amount,sizeof(MIX_Voice)));
+ if (voices==NULL)
+ {
+  Halt("Can't allocate memory for mixer voices");
+ }
+ accumulator=static_cast<int*>(calloc(frames*SOUND_CHANNELS,sizeof(int)));
+ if (accumulator==NULL)
+ {
+  Halt("Can't allocate memory for mixer buffer");
+ }
+ samples=static_cast<short int*>(calloc(frames*SOUND_CHANNELS,sizeof(short int)));
+ if (samples==NULL)
+ {
+  Halt("Can't allocate memory for mixer buffer");
+ }
+ input=static_cast<short int*>(calloc((frames+1)*SOUND_CHANNELS,sizeof(short int)));
+ if (input==NULL)
+ {
+  Halt("Can't allocate memory for mixer buffer");
+ }
+
+}
+
+void Sound_Mixer::check_voice(const size_t voice) const
+{
+ if (voice>=voice_amount)
+ {
+  Halt("Invalid mixer voice");
+ }
+ if (voices==NULL)
+ {
+  Halt("Mixer isn't initialized");
+ }
+
+}
+
+size_t Sound_Mixer::get_free_voice(const unsigned long int priority) const
+{
+ size_t voice,victim;
+ victim=MIXER_NONE;
+ for (voice=0;voice<voice_amount;++voice)
+ {
+  if (voices[voice].active==false)
+  {
+   victim=voice;
+   break;
+  }
+  if ((victim==MIXER_NONE)||(voices[voice].priority<voices[victim].priority))
+  {
+   victim=voice;
+  }
+  else
+  {
+   if ((voices[voice].priority==voices[victim].priority)&&(voices[voice].stamp<voices[victim].stamp)) victim=voice;
+  }
+
+ }
+ if (victim!=MIXER_NONE)
+ {
+  if ((voices[victim].active==true)&&(voices[victim].priority>priority)) victim=MIXER_NONE;
+ }
+ return victim;
+}
+
+void Sound_Mixer::read_frames(MIX_Voice &target,short int *buffer,const size_t position,const size_t amount)
+{
+ size_t index,length;
+ const unsigned char *source;
+ length=amount*target.channels*sizeof(short int);
+ source=target.audio->get_view(position*target.channels*sizeof(short int),length);
+ if (source!=NULL)
+ {
+  memcpy(buffer,source,length);
+ }
+ else
+ {
+  memset(buffer,0,length);
+ }
+ if (target.channels==1)
+ {
+  for (index=amount;index>0;--index)
+  {
+   buffer[2*index-1]=buffer[index-1];
+   buffer[2*index-2]=buffer[index-1];
+  }
+
+ }
+
+}
+
+size_t Sound_Mixer::load_window(MIX_Voice &target)
+{
+ size_t amount;
+ amount=target.length-target.position;
+ if (amount>frames) amount=frames;
+ if (target.position+amount<target.length)
+ {
+  this->read_frames(target,input,target.position,amount+1);
+ }
+ else
+ {
+  this->read_frames(target,input,target.position,amount);
+  if (target.loop==true)
+  {
+   this->read_frames(target,input+amount*SOUND_CHANNELS,0,1);
+  }
+  else
+  {
+   input[amount*SOUND_CHANNELS]=input[(amount-1)*SOUND_CHANNELS];
+   input[amount*SOUND_CHANNELS+1]=input[(amount-1)*SOUND_CHANNELS+1];
+  }
+
+ }
+ return amount;
+}
+
+size_t Sound_Mixer::read_direct(MIX_Voice &target)
+{
+ size_t amount,block;
+ amount=0;
+ while ((amount<frames)&&(target.active==true))
+ {
+  block=target.length-target.position;
+  if (block>frames-amount) block=frames-amount;
+  this->read_frames(target,samples+amount*SOUND_CHANNELS,target.position,block);
+  amount+=block;
+  target.position+=block;
+  if (target.position==target.length)
+  {
+   target.position=0;
+   if (target.loop==false) target.active=false;
+  }
+
+ }
+ return amount;
+}
+
+size_t Sound_Mixer::read_converted(MIX_Voice &target)
+{
+ size_t amount,window,index,offset;
+ unsigned long int fraction,weight;
+ int first,second;
+ amount=0;
+ while ((amount<frames)&&(target.active==true))
+ {
+  window=this->load_window(target);
+  fraction=target.fraction;
+  index=fraction>>16;
+  while ((amount<frames)&&(index<window))
+  {
+   weight=(fraction&(MIXER_STEP-1))>>1;
+   offset=index*SOUND_CHANNELS;
+   first=input[offset];
+   second=input[offset+SOUND_CHANNELS];
+   samples[amount*SOUND_CHANNELS]=static_cast<short int>(first+(((second-first)*static_cast<int>(weight))>>15));
+   first=input[offset+1];
+   second=input[offset+SOUND_CHANNELS+1];
+   samples[amount*SOUND_CHANNELS+1]=static_cast<short int>(first+(((second-first)*static_cast<int>(weight))>>15));
+   ++amount;
+   fraction+=target.step;
+   index=fraction>>16;
+  }
+  target.position+=index;
+  target.fraction=fraction&(MIXER_STEP-1);
+  if (target.position>=target.length)
+  {
+   target.position%=target.length;
+   if (target.loop==false) target.active=false;
+  }
+
+ }
+ return amount;
+}
+
+size_t Sound_Mixer::read_voice(MIX_Voice &target)
+{
+ size_t amount;
+ if ((target.step==MIXER_STEP)&&(target.channels==SOUND_CHANNELS))
+ {
+  amount=this->read_direct(target);
+ }
+ else
+ {
+  amount=this->read_converted(target);
+ }
+ return amount;
+}
+
+void Sound_Mixer::add_samples(const size_t amount)
+{
+ size_t index,last;
+ index=0;
+ last=amount*SOUND_CHANNELS;
+ #if defined(__SSE2__)
+ __m128i source;
+ for (index=0;index+8<=last;index+=8)
+ {
+  source=_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples+index));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(accumulator+index),_mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(accumulator+index)),_mm_srai_epi32(_mm_unpacklo_epi16(source,source),16)));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(accumulator+index+4),_mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(accumulator+index+4)),_mm_srai_epi32(_mm_unpackhi_epi16(source,source),16)));
+ }
+ #elif defined(__ARM_NEON)||defined(__ARM_NEON__)
+ for (index=0;index+4<=last;index+=4)
+ {
+  vst1q_s32(accumulator+index,vaddq_s32(vld1q_s32(accumulator+index),vmovl_s16(vld1_s16(samples+index))));
+ }
+ #endif
+ for (;index<last;++index)
+ {
+  accumulator[index]+=samples[index];
+ }
+
+}
+
+void Sound_Mixer::scale_samples(const int left,const int right,const size_t amount)
+{
+ size_t index,last;
+ index=0;
+ last=amount*SOUND_CHANNELS;
+ #if defined(__SSE2__)
+ __m128i factor,rounding,source,low,high,first,second;
+ factor=_mm_setr_epi16(left,right,left,right,left,right,left,right);
+ rounding=_mm_set1_epi32(MIXER_ROUND);
+ for (index=0;index+8<=last;index+=8)
+ {
+  source=_mm_loadu_si128(reinterpret_cast<const __m128i*>(samples+index));
+  low=_mm_mullo_epi16(source,factor);
+  high=_mm_mulhi_epi16(source,factor);
+  first=_mm_srai_epi32(_mm_add_epi32(_mm_unpacklo_epi16(low,high),rounding),15);
+  second=_mm_srai_epi32(_mm_add_epi32(_mm_unpackhi_epi16(low,high),rounding),15);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(accumulator+index),_mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(accumulator+index)),first));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(accumulator+index+4),_mm_add_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(accumulator+index+4)),second));
+ }
+ #elif defined(__ARM_NEON)||defined(__ARM_NEON__)
+ int16x4_t factor;
+ int32x4_t product;
+ factor=vdup_n_s16(static_cast<short int>(left));
+ factor=vset_lane_s16(static_cast<short int>(right),factor,1);
+ factor=vset_lane_s16(static_cast<short int>(right),factor,3);
+ for (index=0;index+4<=last;index+=4)
+ {
+  product=vrshrq_n_s32(vmull_s16(vld1_s16(samples+index),factor),15);
+  vst1q_s32(accumulator+index,vaddq_s32(vld1q_s32(accumulator+index),product));
+ }
+ #endif
+ for (;index<last;index+=SOUND_CHANNELS)
+ {
+  accumulator[index]+=(static_cast<int>(samples[index])*left+MIXER_ROUND)>>15;
+  accumulator[index+1]+=(static_cast<int>(samples[index+1])*right+MIXER_ROUND)>>15;
+ }
+
+}
+
+void Sound_Mixer::mix_voice(const unsigned short int volume,const short int pan,const size_t amount)
+{
+ int gain,left,right;
+ gain=(static_cast<int>(volume)*static_cast<int>(master)+MIXER_UNITY)>>15;
+ left=gain;
+ right=gain;
+ if (pan>0) left=(gain*(MIXER_UNITY-pan)+MIXER_UNITY)>>15;
+ if (pan<0) right=(gain*(MIXER_UNITY+pan)+MIXER_UNITY)>>15;
+ if ((left==MIXER_UNITY)&&(right==MIXER_UNITY))
+ {
+  this->add_samples(amount);
+ }
+ else
+ {
+  this->scale_samples(left,right,amount);
+ }
+
+}
+
+void Sound_Mixer::store_samples(short int *target)
+{
+ size_t index,last;
+ int sample;
+ index=0;
+ last=frames*SOUND_CHANNELS;
+ #if defined(__SSE2__)
+ for (index=0;index+8<=last;index+=8)
+ {
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(target+index),_mm_packs_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(accumulator+index)),_mm_loadu_si128(reinterpret_cast<const __m128i*>(accumulator+index+4))));
+ }
+ #elif defined(__ARM_NEON)||defined(__ARM_NEON__)
+ for (index=0;index+4<=last;index+=4)
+ {
+  vst1_s16(target+index,vqmovn_s32(vld1q_s32(accumulator+index)));
+ }
+ #endif
+ for (;index<last;++index)
+ {
+  sample=accumulator[index];
+  if (sample>32767) sample=32767;
+  if (sample<-32768) sample=-32768;
+  target[index]=static_cast<short int>(sample);
+ }
+
+}
+
+void Sound_Mixer::mix_period(short int *target)
+{
+ size_t voice,amount;
+ memset(accumulator,0,frames*SOUND_CHANNELS*sizeof(int));
+ for (voice=0;voice<voice_amount;++voice)
+ {
+  if (voices[voice].active==true)
+  {
+   amount=this->read_voice(voices[voice]);
+   this->mix_voice(voices[voice].volume,voices[voice].pan,amount);
+  }
+
+ }
+ if (music!=NULL)
+ {
+  this->check_music();
+  amount=music->read(samples,frames);
+  this->mix_voice(music_volume,0,amount);
+ }
+ this->store_samples(target);
+}
+
+void Sound_Mixer::check_music() const
+{
+ if ((sound!=NULL)&&(music->get_length()>0))
+ {
+  if (music->get_rate()!=static_cast<unsigned long int>(sound->get_rate()))
+  {
+   Halt("Music rate doesn't match the sound rate");
+  }
+
+ }
+
+}
+
+void Sound_Mixer::set_voices(const size_t amount)
+{
+ if (voices==NULL)
+ {
+  voice_amount=amount;
+  if (voice_amount==0) voice_amount=1;
+ }
+
+}
+
+size_t Sound_Mixer::get_voices() const
+{
+ return voice_amount;
+}
+
+void Sound_Mixer::initialize(Sound *target)
+{
+ if (voices==NULL)
+ {
+  if ((target->get_rate()==0)||(target->get_length()==0))
+  {
+   Halt("Sound subsystem isn't initialized");
+  }
+  sound=target;
+  frames=sound->get_length()/MIXER_FRAME;
+  this->create_buffers();
+ }
+
+}
+
+size_t Sound_Mixer::play(Audio &audio,const unsigned long int priority,const bool loop)
+{
+ size_t voice;
+ if (voices==NULL)
+ {
+  Halt("Mixer isn't initialized");
+ }
+ voice=this->get_free_voice(priority);
+ if (voice!=MIXER_NONE)
+ {
+  ++stamp;
+  voices[voice].audio=audio.get_handle();
+  voices[voice].position=0;
+  voices[voice].channels=audio.get_channels();
+  voices[voice].length=audio.get_total()/(voices[voice].channels*sizeof(short int));
+  voices[voice].step=static_cast<unsigned long int>((static_cast<unsigned long long int>(audio.get_rate())*MIXER_STEP)/static_cast<unsigned long long int>(sound->get_rate()));
+  if (voices[voice].step==0) voices[voice].step=1;
+  voices[voice].fraction=0;
+  voices[voice].priority=priority;
+  voices[voice].stamp=stamp;
+  voices[voice].volume=MIXER_UNITY;
+  voices[voice].pan=0;
+  voices[voice].loop=loop;
+  voices[voice].active=(voices[voice].length>0);
+ }
+ return voice;
+}
+
+void Sound_Mixer::stop(const size_t voice)
+{
+ this->check_voice(voice);
+ voices[voice].active=false;
+}
+
+void Sound_Mixer::stop_all()
+{
+ size_t voice;
+ if (voices!=NULL)
+ {
+  for (voice=0;voice<voice_amount;++voice)
+  {
+   voices[voice].active=false;
+  }
+
+ }
+
+}
+
+bool Sound_Mixer::check_playing(const size_t voice) const
+{
+ this->check_voice(voice);
+ return voices[voice].active;
+}
+
+void Sound_Mixer::set_volume(const size_t voice,const unsigned short int level)
+{
+ this->check_voice(voice);
+ voices[voice].volume=MIXER_UNITY;
+ if (level<MIXER_UNITY) voices[voice].volume=level;
+}
+
+void Sound_Mixer::set_pan(const size_t voice,const short int position)
+{
+ this->check_voice(voice);
+ voices[voice].pan=position;
+ if (position<-static_cast<short int>(MIXER_UNITY)) voices[voice].pan=-static_cast<short int>(MIXER_UNITY);
+}
+
+void Sound_Mixer::set_master_volume(const unsigned short int level)
+{
+ master=MIXER_UNITY;
+ if (level<MIXER_UNITY) master=level;
+}
+
+unsigned short int Sound_Mixer::get_master_volume() const
+{
+ return master;
+}
+
+void Sound_Mixer::set_music(Music_Stream *target)
+{
+ music=target;
+ if (music!=NULL) this->check_music();
+}
+
+void Sound_Mixer::set_music_volume(const unsigned short int level)
+{
+ music_volume=MIXER_UNITY;
+ if (level<MIXER_UNITY) music_volume=level;
+}
+
+unsigned short int Sound_Mixer::get_music_volume() const
+{
+ return music_volume;
+}
+
+size_t Sound_Mixer::get_active() const
+{
+ size_t voice,amount;
+ amount=0;
+ if (voices!=NULL)
+ {
+  for (voice=0;voice<voice_amount;++voice)
+  {
+   if (voices[voice].active==true) ++amount;
+  }
+
+ }
+ return amount;
+}
+
+void Sound_Mixer::update()
+{
+ char *period;
+ if (voices!=NULL)
+ {
+  while (sound->check_busy()==false)
+  {
+   period=sound->acquire_period();
+   this->mix_period(reinterpret_cast<short int*>(period));
+   sound->release_period(frames*MIXER_FRAME);
+  }
+
+ }
+
+}
+
+Sound_Mixer* Sound_Mixer::get_handle()
+{
+ return this;
+}
+
+Primitive::Primitive()
+{
+ surface=NULL;
+ color=0;
+ buffer=NULL;
+ frame_width=0;
+ frame_height=0;
+ batch=false;
+ edges=NULL;
+ edge_amount=0;
+}
+
+Primitive::~Primitive()
+{
+ if (edges!=NULL) free(edges);
+}
+
+void Primitive::prepare_surface()
+{
+ if (batch==false)
+ {
+  buffer=surface->get_buffer();
+  frame_width=surface->get_frame_width();
+  frame_height=surface->get_frame_height();
+ }
+
+}
+
+void Primitive::draw_pixel(const long int x,const long int y)
+{
+ if ((x>=0)&&(y>=0)&&(x<frame_width)&&(y<frame_height))
+ {
+  buffer[static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(frame_width)]=color;
+ }
+
+}
+
+void Primitive::draw_span(const long int x1,const long int x2,const long int y)
+{
+ long int left,right;
+ unsigned short int *target;
+ left=x1;
+ right=x2;
+ if (left>right)
+ {
+  left=x2;
+  right=x1;
+ }
+ if ((y>=0)&&(y<frame_height)&&(right>=0)&&(left<frame_width))
+ {
+  if (left<0) left=0;
+  if (right>=frame_width) right=frame_width-1;
+  target=buffer+static_cast<size_t>(y)*static_cast<size_t>(frame_width);
+  for (;left<=right;++left)
+  {
+   target[left]=color;
+  }
+
+ }
+
+}
+
+void Primitive::draw_vertical_span(const long int x,const long int y1,const long int y2)
+{
+ long int top,bottom;
+ unsigned short int *target;
+ top=y1;
+ bottom=y2;
+ if (top>bottom)
+ {
+  top=y2;
+  bottom=y1;
+ }
+ if ((x>=0)&&(x<frame_width)&&(bottom>=0)&&(top<frame_height))
+ {
+  if (top<0) top=0;
+  if (bottom>=frame_height) bottom=frame_height-1;
+  target=buffer+static_cast<size_t>(x)+static_cast<size_t>(top)*static_cast<size_t>(frame_width);
+  for (;top<=bottom;++top)
+  {
+   *target=color;
+   target+=frame_width;
+  }
+
+ }
+
+}
+
+void Primitive::draw_segment(const long int x1,const long int y1,const long int x2,const long int y2)
+{
+ long int x,y,delta_x,delta_y,step_x,step_y,error,double_error;
+ if (y1==y2)
+ {
+  this->draw_span(x1,x2,y1);
+ }
+ else if (x1==x2)
+ {
+  this->draw_vertical_span(x1,y1,y2);
+ }
+ else
+ {
+  x=x1;
+  y=y1;
+  delta_x=x2-x1;
+  delta_y=y1-y2;
+  step_x=1;
+  step_y=1;
+  if (delta_x<0)
+  {
+   delta_x=-delta_x;
+   step_x=-1;
+  }
+  if (delta_y>0)
+  {
+   delta_y=-delta_y;
+   step_y=-1;
+  }
+  error=delta_x+delta_y;
+  while (true)
+  {
+   this->draw_pixel(x,y);
+   if ((x==x2)&&(y==y2)) break;
+   double_error=2*error;
+   if (double_error>=delta_y)
+   {
+    error+=delta_y;
+    x+=step_x;
+   }
+   if (double_error<=delta_x)
+   {
+    error+=delta_x;
+    y+=step_y;
+   }
+
+  }
+
+ }
+
+}
+
+void Primitive::fill_rectangle(const long int x,const long int y,const unsigned long int width,const unsigned long int height)
+{
+ long int top,bottom;
+ if ((width>0)&&(height>0))
+ {
+  top=y;
+  bottom=y+static_cast<long int>(height);
+  if (top<0) top=0;
+  if (bottom>frame_height) bottom=frame_height;
+  for (;top<bottom;++top)
+  {
+   this->draw_span(x,x+static_cast<long int>(width)-1,top);
+  }
+
+ }
+
+}
+
+void Primitive::draw_circle_points(const long int x,const long int y,const long int shift_x,const long int shift_y)
+{
+ this->draw_pixel(x+shift_x,y+shift_y);
+ this->draw_pixel(x-shift_x,y+shift_y);
+ this->draw_pixel(x+shift_x,y-shift_y);
+ this->draw_pixel(x-shift_x,y-shift_y);
+ this->draw_pixel(x+shift_y,y+shift_x);
+ this->draw_pixel(x-shift_y,y+shift_x);
+ this->draw_pixel(x+shift_y,y-shift_x);
+ this->draw_pixel(x-shift_y,y-shift_x);
+}
+
+void Primitive::fill_circle(const long int x,const long int y,const long int radius)
+{
+ long int shift_x,shift_y,error;
+ shift_x=radius;
+ shift_y=0;
+ error=1-radius;
+ while (shift_x>=shift_y)
+ {
+  this->draw_span(x-shift_x,x+shift_x,y+shift_y);
+  if (shift_y!=0) this->draw_span(x-shift_x,x+shift_x,y-shift_y);
+  ++shift_y;
+  if (error<0)
+  {
+   error+=2*shift_y+1;
+  }
+  else
+  {
+   if (shift_x>=shift_y)
+   {
+    this->draw_span(x-shift_y+1,x+shift_y-1,y+shift_x);
+    this->draw_span(x-shift_y+1,x+shift_y-1,y-shift_x);
+   }
+   --shift_x;
+   error+=2*(shift_y-shift_x)+1;
+  }
+
+ }
+
+}
+
+void Primitive::trace_ellipse(const long int x,const long int y,const long int radius_x,const long int radius_y,const bool filled)
+{
+ long int shift_x,shift_y;
+ long long int square_x,square_y,step_x,step_y,decision;
+ if ((radius_x==0)||(radius_y==0))
+ {
+  this->draw_segment(x-radius_x,y-radius_y,x+radius_x,y+radius_y);
+  return;
+ }
+ square_x=static_cast<long long int>(radius_x)*radius_x;
+ square_y=static_cast<long long int>(radius_y)*radius_y;
+ shift_x=0;
+ shift_y=radius_y;
+ step_x=0;
+ step_y=2*square_x*shift_y;
+ decision=square_y-square_x*radius_y+(square_x+2)/4;
+ while (step_x<step_y)
+ {
+  if (filled==false)
+  {
+   this->draw_pixel(x+shift_x,y+shift_y);
+   this->draw_pixel(x-shift_x,y+shift_y);
+   this->draw_pixel(x+shift_x,y-shift_y);
+   this->draw_pixel(x-shift_x,y-shift_y);
+  }
+  ++shift_x;
+  step_x+=2*square_y;
+  if (decision<0)
+  {
+   decision+=square_y+step_x;
+  }
+  else
+  {
+   if (filled==true)
+   {
+    this->draw_span(x-shift_x+1,x+shift_x-1,y+shift_y);
+    this->draw_span(x-shift_x+1,x+shift_x-1,y-shift_y);
+   }
+   --shift_y;
+   step_y-=2*square_x;
+   decision+=square_y+step_x-step_y;
+  }
+
+ }
+ decision=square_y*(static_cast<long long int>(shift_x)*shift_x+shift_x)+(square_y+2)/4+square_x*(static_cast<long long int>(shift_y-1)*(shift_y-1))-square_x*square_y;
+ while (shift_y>=0)
+ {
+  if (filled==true)
+  {
+   this->draw_span(x-shift_x,x+shift_x,y+shift_y);
+   if (shift_y!=0) this->draw_span(x-shift_x,x+shift_x,y-shift_y);
+  }
+  else
+  {
+   this->draw_pixel(x+shift_x,y+shift_y);
+   this->draw_pixel(x-shift_x,y+shift_y);
+   this->draw_pixel(x+shift_x,y-shift_y);
+   this->draw_pixel(x-shift_x,y-shift_y);
+  }
+  --shift_y;
+  step_y-=2*square_x;
+  if (decision>0)
+  {
+   decision+=square_x-step_y;
+  }
+  else
+  {
+   ++shift_x;
+   step_x+=2*square_y;
+   decision+=square_x-step_y+step_x;
+  }
+
+ }
+
+}
+
+void Primitive::create_edges(const size_t amount)
+{
+ PRM_Edge *target;
+ if (amount>edge_amount)
+ {
+  target=static_cast<PRM_Edge*>(realloc(edges,amount*sizeof(PRM_Edge)));
+  if (target==NULL)
+  {
+   Halt("Can't allocate memory for polygon edges");
+  }
+  edges=target;
+  edge_amount=amount;
+ }
+
+}
+
+void Primitive::fill_polygon(const PRM_Point *points,const size_t amount)
+{
+ size_t index,active;
+ long int top,bottom,left,right,row,start,offset;
+ const PRM_Point *first;
+ const PRM_Point *second;
+ if (amount==0) return;
+ this->create_edges(amount);
+ top=points[0].y;
+ bottom=points[0].y;
+ left=points[0].x;
+ right=points[0].x;
+ active=0;
+ for (index=0;index<amount;++index)
+ {
+  if (points[index].y<top) top=points[index].y;
+  if (points[index].y>bottom) bottom=points[index].y;
+  if (points[index].x<left) left=points[index].x;
+  if (points[index].x>right) right=points[index].x;
+  first=points+index;
+  second=points+(index+1)%amount;
+  if (first->y==second->y) continue;
+  if (first->y>second->y)
+  {
+   first=second;
+   second=points+index;
+  }
+  edges[active].top=first->y;
+  edges[active].bottom=second->y;
+  edges[active].delta_y=second->y-first->y;
+  edges[active].delta_x=second->x-first->x;
+  edges[active].step=1;
+  if (edges[active].delta_x<0)
+  {
+   edges[active].delta_x=-edges[active].delta_x;
+   edges[active].step=-1;
+  }
+  start=first->y;
+  if (start<0) start=0;
+  offset=edges[active].delta_x*(start-first->y)+edges[active].delta_y/2;
+  edges[active].x=first->x+edges[active].step*(offset/edges[active].delta_y);
+  edges[active].error=offset%edges[active].delta_y;
+  ++active;
+ }
+ if (active==0)
+ {
+  this->draw_span(left,right,top);
+  return;
+ }
+ if (top<0) top=0;
+ if (bottom>=frame_height) bottom=frame_height-1;
+ for (row=top;row<=bottom;++row)
+ {
+  left=0;
+  right=-1;
+  for (index=0;index<active;++index)
+  {
+   PRM_Edge &edge=edges[index];
+   if ((row<edge.top)||(row>edge.bottom)) continue;
+   if (right<left)
+   {
+    left=edge.x;
+    right=edge.x;
+   }
+   else
+   {
+    if (edge.x<left) left=edge.x;
+    if (edge.x>right) right=edge.x;
+   }
+   edge.error+=edge.delta_x;
+   while (edge.error>=edge.delta_y)
+   {
+    edge.x+=edge.step;
+    edge.error-=edge.delta_y;
+   }
+
+  }
+  if (left<=right) this->draw_span(left,right,row);
+ }
+
+}
+
+void Primitive::initialize(Screen *screen)
+{
+ surface=screen;
+}
+
+void Primitive::set_color(const unsigned char red,const unsigned char green,const unsigned char blue)
+{
+ color=pack_pixel(red,green,blue);
+}
+
+void Primitive::begin_batch()
+{
+ batch=false;
+ this->prepare_surface();
+ batch=true;
+}
+
+void Primitive::end_batch()
+{
+ batch=false;
+}
+
+void Primitive::draw_line(const unsigned long int x1,const unsigned long int y1,const unsigned long int x2,const unsigned long int y2)
+{
+ this->prepare_surface();
+ this->draw_segment(x1,y1,x2,y2);
+}
+
+void Primitive::draw_rectangle(const unsigned long int x,const unsigned long int y,const unsigned long int width,const unsigned long int height)
+{
+ unsigned long int stop_x,stop_y;
+ stop_x=x+width;
+ stop_y=y+height;
+ this->draw_line(x,y,stop_x,y);
+ this->draw_line(x,stop_y,stop_x,stop_y);
+ this->draw_line(x,y,x,stop_y);
+ this->draw_line(stop_x,y,stop_x,stop_y);
+}
+
+void Primitive::draw_filled_rectangle(const unsigned long int x,const unsigned long int y,const unsigned long int width,const unsigned long int height)
+{
+ this->prepare_surface();
+ this->fill_rectangle(x,y,width,height);
+}
+
+void Primitive::draw_circle(const unsigned long int x,const unsigned long int y,const unsigned long int radius)
+{
+ long int shift_x,shift_y,error;
+ this->prepare_surface();
+ shift_x=radius;
+ shift_y=0;
+ error=1-shift_x;
+ while (shift_x>=shift_y)
+ {
+  this->draw_circle_points(x,y,shift_x,shift_y);
+  ++shift_y;
+  if (error<0)
+  {
+   error+=2*shift_y+1;
+  }
+  else
+  {
+   --shift_x;
+   error+=2*(shift_y-shift_x)+1;
+  }
+
+ }
+
+}
+
+void Primitive::draw_filled_circle(const unsigned long int x,const unsigned long int y,const unsigned long int radius)
+{
+ this->prepare_surface();
+ this->fill_circle(x,y,radius);
+}
+
+void Primitive::draw_ellipse(const unsigned long int x,const unsigned long int y,const unsigned long int radius_x,const unsigned long int radius_y)
+{
+ this->prepare_surface();
+ this->trace_ellipse(x,y,radius_x,radius_y,false);
+}
+
+void Primitive::draw_filled_ellipse(const unsigned long int x,const unsigned long int y,const unsigned long int radius_x,const unsigned long int radius_y)
+{
+ this->prepare_surface();
+ this->trace_ellipse(x,y,radius_x,radius_y,true);
+}
+
+void Primitive::draw_triangle(const unsigned long int x1,const unsigned long int y1,const unsigned long int x2,const unsigned long int y2,const unsigned long int x3,const unsigned long int y3)
+{
+ this->prepare_surface();
+ this->draw_segment(x1,y1,x2,y2);
+ this->draw_segment(x2,y2,x3,y3);
+ this->draw_segment(x3,y3,x1,y1);
+}
+
+void Primitive::draw_filled_triangle(const unsigned long int x1,const unsigned long int y1,const unsigned long int x2,const unsigned long int y2,const unsigned long int x3,const unsigned long int y3)
+{
+ PRM_Point points[3];
+ points[0].x=x1;
+ points[0].y=y1;
+ points[1].x=x2;
+ points[1].y=y2;
+ points[2].x=x3;
+ points[2].y=y3;
+ this->prepare_surface();
+ this->fill_polygon(points,3);
+}
+
+void Primitive::draw_polygon(const PRM_Point *points,const size_t amount)
+{
+ size_t index;
+ this->prepare_surface();
+ for (index=0;index<amount;++index)
+ {
+  this->draw_segment(points[index].x,points[index].y,points[(index+1)%amount].x,points[(index+1)%amount].y);
+ }
+
+}
+
+void Primitive::draw_filled_polygon(const PRM_Point *points,const size_t amount)
+{
+ this->prepare_surface();
+ this->fill_polygon(points,amount);
+}
+
+void Primitive::draw_points(const PRM_Point *points,const size_t amount)
+{
+ size_t index;
+ this->prepare_surface();
+ for (index=0;index<amount;++index)
+ {
+  this->draw_pixel(points[index].x,points[index].y);
+ }
+
+}
+
+void Primitive::draw_lines(const PRM_Point *points,const size_t amount)
+{
+ size_t index;
+ this->prepare_surface();
+ for (index=1;index<amount;index+=2)
+ {
+  this->draw_segment(points[index-1].x,points[index-1].y,points[index].x,points[index].y);
+ }
+
+}
+
+void Primitive::draw_filled_rectangles(const PRM_Rectangle *rectangles,const size_t amount)
+{
+ size_t index;
+ this->prepare_surface();
+ for (index=0;index<amount;++index)
+ {
+  this->fill_rectangle(rectangles[index].x,rectangles[index].y,rectangles[index].width,rectangles[index].height);
+ }
+
+}
+
+void Primitive::draw_filled_circles(const PRM_Point *centers,const size_t amount,const unsigned long int radius)
+{
+ size_t index;
+ this->prepare_surface();
+ for (index=0;index<amount;++index)
+ {
+  this->fill_circle(centers[index].x,centers[index].y,radius);
+ }
+
+}
+
+Image::Image()
+{
+ width=0;
+ height=0;
+ data=NULL;
+ transfer=false;
+ packed=false;
+ shared=false;
+ cache=NULL;
 }
 
 Image::~Image()
 {
- if (data!=NULL)
- {
-  delete[] data;
-  data=NULL;
- }
+ this->clear_buffer();
+}
+
+unsigned char *Image::create_buffer(const size_t length)
+{
+ unsigned char *result;
+ result=static_cast<unsigned char*>(calloc(length+1,sizeof(unsigned char)));
+ if (result==NULL)
+ {
+  Halt("Can't allocate memory for image buffer");
+ }
+ return result;
+}
+
+void Image::clear_buffer()
+{
+ if (data!=NULL)
+ {
+  free(data);
+  data=NULL;
+ }
+
+}
+
+size_t Image::get_pixel_size() const
+{
+ size_t result;
+ result=3;
+ if (packed==true)
+ {
+  result=sizeof(unsigned short int);
+ }
+ return result;
+}
+
+IMG_Pixel Image::read_tga_color(const unsigned char *source,const size_t size) const
+{
+ unsigned short int color;
+ IMG_Pixel result;
+ if (size==2)
+ {
+  color=static_cast<unsigned short int>(source[0])|(static_cast<unsigned short int>(source[1])<<8);
+  result.red=static_cast<unsigned char>((((color>>10)&31)<<3)|(((color>>10)&31)>>2));
+  result.green=static_cast<unsigned char>((((color>>5)&31)<<3)|(((color>>5)&31)>>2));
+  result.blue=static_cast<unsigned char>(((color&31)<<3)|((color&31)>>2));
+ }
+ else
+ {
+  result.blue=source[0];
+  result.green=source[1];
+  result.red=source[2];
+ }
+ return result;
+}
+
+void Image::expand_run(unsigned char *target,const size_t size,const size_t amount)
+{
+ size_t filled,length,total;
+ filled=size;
+ total=size*amount;
+ while (filled<total)
+ {
+  length=filled;
+  if (length>total-filled)
+  {
+   length=total-filled;
+  }
+  memcpy(target+filled,target,length);
+  filled+=length;
+ }
+
+}
+
+void Image::store_pixel(const size_t index,const IMG_Pixel &pixel)
+{
+ if (packed==true)
+ {
+  reinterpret_cast<unsigned short int*>(data)[index]=pack_pixel(pixel.red,pixel.green,pixel.blue);
+ }
+ else
+ {
+  reinterpret_cast<IMG_Pixel*>(data)[index]=pixel;
+ }
+
+}
+
+void Image::read_tga_format(const unsigned char *source,const size_t length,TGA_format &format) const
+{
+ TGA_head head;
+ TGA_map color_map;
+ TGA_image image;
+ if ((source==NULL)||(length<18))
+ {
+  Halt("Invalid image format");
+ }
+ memcpy(&head,source,3);
+ memcpy(&color_map,source+3,5);
+ memcpy(&image,source+8,10);
+ format.descriptor=source[17];
+ format.mapped=(head.type==1)||(head.type==9);
+ format.compressed=(head.type==9)||(head.type==10);
+ if ((format.mapped==false)&&(head.type!=2)&&(head.type!=10))
+ {
+  Halt("Invalid image format");
+ }
+ format.size=(static_cast<size_t>(image.color)+7)/8;
+ format.depth=(static_cast<size_t>(color_map.map_size)+7)/8;
+ format.first=color_map.index;
+ format.colors=0;
+ if (head.color_map!=0)
+ {
+  format.colors=color_map.length;
+ }
+ if (format.mapped==true)
+ {
+  if ((format.colors==0)||(format.size<1)||(format.size>2)||(format.depth<2)||(format.depth>4))
+  {
+   Halt("Invalid image format");
+  }
+
+ }
+ else
+ {
+  if ((format.size<2)||(format.size>4))
+  {
+   Halt("Invalid image format");
+  }
+
+ }
+ if ((image.width==0)||(image.height==0))
+ {
+  Halt("Invalid image format");
+ }
+ format.width=image.width;
+ format.height=image.height;
+ format.palette=18+static_cast<size_t>(head.id);
+ if ((format.palette>length)||(format.colors*format.depth>length-format.palette))
+ {
+  Halt("Invalid image format");
+ }
+ format.position=format.palette+format.colors*format.depth;
+}
+
+IMG_Pixel *Image::read_tga_palette(const unsigned char *source,const TGA_format &format)
+{
+ IMG_Pixel *palette;
+ size_t index;
+ palette=NULL;
+ if (format.mapped==true)
+ {
+  palette=reinterpret_cast<IMG_Pixel*>(this->create_buffer(format.colors*sizeof(IMG_Pixel)));
+  for (index=0;index<format.colors;++index)
+  {
+   palette[index]=this->read_tga_color(source+format.palette+index*format.depth,format.depth);
+  }
+
+ }
+ return palette;
+}
+
+void Image::decode_tga_pixels(const unsigned char *source,const size_t length,TGA_Cursor &cursor,unsigned char *target,const size_t amount,const size_t size)
+{
+ size_t index,position,count,chunk;
+ bool repeat;
+ index=0;
+ while (index<amount)
+ {
+  position=cursor.position;
+  if (position>=length)
+  {
+   Halt("Invalid image format");
+  }
+  repeat=source[position]>127;
+  count=static_cast<size_t>(source[position]&127)+1;
+  ++position;
+  if (repeat==true)
+  {
+   if (size>length-position)
+   {
+    Halt("Invalid image format");
+   }
+
+  }
+  else
+  {
+   if (count*size>length-position)
+   {
+    Halt("Invalid image format");
+   }
+
+  }
+  chunk=count-cursor.skip;
+  if (chunk>amount-index)
+  {
+   chunk=amount-index;
+  }
+  if (target!=NULL)
+  {
+   if (repeat==true)
+   {
+    memcpy(target+index*size,source+position,size);
+    this->expand_run(target+index*size,size,chunk);
+   }
+   else
+   {
+    memcpy(target+index*size,source+position+cursor.skip*size,chunk*size);
+   }
+
+  }
+  index+=chunk;
+  cursor.skip+=chunk;
+  if (cursor.skip==count)
+  {
+   cursor.position=position+size;
+   if (repeat==false) cursor.position=position+count*size;
+   cursor.skip=0;
+  }
+
+ }
+
+}
+
+const unsigned char *Image::read_tga_line(const unsigned char *source,const size_t length,TGA_Cursor &cursor,unsigned char *decoded,const TGA_format &format)
+{
+ const unsigned char *line;
+ size_t amount;
+ amount=static_cast<size_t>(width)*format.size;
+ if (format.compressed==true)
+ {
+  this->decode_tga_pixels(source,length,cursor,decoded,width,format.size);
+  line=decoded;
+ }
+ else
+ {
+  if ((cursor.position>length)||(amount>length-cursor.position))
+  {
+   Halt("Invalid image format");
+  }
+  line=source+cursor.position;
+  cursor.position+=amount;
+ }
+ return line;
+}
+
+void Image::store_tga_line(const unsigned char *line,const unsigned long int row,const TGA_format &format,const IMG_Pixel *palette)
+{
+ unsigned long int x,column;
+ size_t index,value,size;
+ size=format.size;
+ if ((format.mapped==false)&&(size==3)&&(packed==false)&&((format.descriptor&16)==0))
+ {
+  memcpy(data+static_cast<size_t>(row)*static_cast<size_t>(width)*3,line,static_cast<size_t>(width)*3);
+ }
+ else
+ {
+  for (x=0;x<width;++x)
+  {
+   column=x;
+   if ((format.descriptor&16)!=0)
+   {
+    column=width-1-x;
+   }
+   index=static_cast<size_t>(row)*static_cast<size_t>(width)+static_cast<size_t>(column);
+   if (format.mapped==true)
+   {
+    value=line[x*size];
+    if (size==2)
+    {
+     value|=static_cast<size_t>(line[x*size+1])<<8;
+    }
+    if ((value<format.first)||(value-format.first>=format.colors))
+    {
+     Halt("Invalid image format");
+    }
+    this->store_pixel(index,palette[value-format.first]);
+   }
+   else
+   {
+    this->store_pixel(index,this->read_tga_color(line+x*size,size));
+   }
+
+  }
+
+ }
+
+}
+
+void Image::load_tga(Input_File &target)
+{
+ unsigned long int y,row;
+ size_t length;
+ const unsigned char *source;
+ unsigned char *decoded;
+ IMG_Pixel *palette;
+ TGA_format format;
+ TGA_Cursor cursor;
+ this->clear_buffer();
+ length=static_cast<size_t>(target.get_length());
+ source=target.get_view(0,length);
+ this->read_tga_format(source,length,format);
+ palette=this->read_tga_palette(source,format);
+ width=format.width;
+ height=format.height;
+ data=this->create_buffer(this->get_length());
+ decoded=NULL;
+ if (format.compressed==true)
+ {
+  decoded=this->create_buffer(static_cast<size_t>(width)*format.size);
+ }
+ cursor.position=format.position;
+ cursor.skip=0;
+ for (y=0;y<height;++y)
+ {
+  row=height-1-y;
+  if ((format.descriptor&32)!=0)
+  {
+   row=y;
+  }
+  this->store_tga_line(this->read_tga_line(source,length,cursor,decoded,format),row,format,palette);
+ }
+ if (decoded!=NULL)
+ {
+  free(decoded);
+ }
+ if (palette!=NULL)
+ {
+  free(palette);
+ }
+
+}
+
+void Image::load_tga(Input_File &target,const TGA_Cursor *rows,const unsigned long int region_width,const unsigned long int region_height)
+{
+ unsigned long int y;
+ size_t length;
+ const unsigned char *source;
+ unsigned char *decoded;
+ IMG_Pixel *palette;
+ TGA_format format;
+ TGA_Cursor cursor;
+ this->clear_buffer();
+ length=static_cast<size_t>(target.get_length());
+ source=target.get_view(0,length);
+ this->read_tga_format(source,length,format);
+ if ((rows==NULL)||(region_width==0)||(region_height==0)||(region_width>format.width)||(region_height>format.height))
+ {
+  Halt("Invalid image format");
+ }
+ palette=this->read_tga_palette(source,format);
+ width=region_width;
+ height=region_height;
+ data=this->create_buffer(this->get_length());
+ decoded=NULL;
+ if (format.compressed==true)
+ {
+  decoded=this->create_buffer(static_cast<size_t>(width)*format.size);
+ }
+ for (y=0;y<height;++y)
+ {
+  cursor=rows[y];
+  this->store_tga_line(this->read_tga_line(source,length,cursor,decoded,format),y,format,palette);
+ }
+ if (decoded!=NULL)
+ {
+  free(decoded);
+ }
+ if (palette!=NULL)
+ {
+  free(palette);
+ }
+
+}
+
+TGA_Cursor *Image::index_tga(Input_File &target,const unsigned long int columns,unsigned long int &image_width,unsigned long int &image_height)
+{
+ unsigned long int x,y,row,block,index,column,block_width;
+ size_t length,amount;
+ const unsigned char *source;
+ TGA_Cursor *result;
+ TGA_format format;
+ TGA_Cursor cursor;
+ length=static_cast<size_t>(target.get_length());
+ source=target.get_view(0,length);
+ this->read_tga_format(source,length,format);
+ if ((columns==0)||(format.width<columns))
+ {
+  Halt("Invalid image format");
+ }
+ block_width=format.width/columns;
+ amount=static_cast<size_t>(format.width)*format.size;
+ if ((format.compressed==false)&&(amount*static_cast<size_t>(format.height)>length-format.position))
+ {
+  Halt("Invalid image format");
+ }
+ result=reinterpret_cast<TGA_Cursor*>(this->create_buffer(static_cast<size_t>(format.height)*static_cast<size_t>(columns)*sizeof(TGA_Cursor)));
+ cursor.position=format.position;
+ cursor.skip=0;
+ for (y=0;y<format.height;++y)
+ {
+  row=format.height-1-y;
+  if ((format.descriptor&32)!=0)
+  {
+   row=y;
+  }
+  x=0;
+  for (block=0;block<columns;++block)
+  {
+   index=block;
+   column=block*block_width;
+   if ((format.descriptor&16)!=0)
+   {
+    index=columns-1-block;
+    column=format.width-(columns-block)*block_width;
+   }
+   if (format.compressed==true)
+   {
+    this->decode_tga_pixels(source,length,cursor,NULL,column-x,format.size);
+    x=column;
+    result[static_cast<size_t>(row)*static_cast<size_t>(columns)+index]=cursor;
+   }
+   else
+   {
+    result[static_cast<size_t>(row)*static_cast<size_t>(columns)+index].position=format.position+static_cast<size_t>(y)*amount+static_cast<size_t>(column)*format.size;
+    result[static_cast<size_t>(row)*static_cast<size_t>(columns)+index].skip=0;
+   }
+
+  }
+  if (format.compressed==true)
+  {
+   this->decode_tga_pixels(source,length,cursor,NULL,format.width-x,format.size);
+  }
+
+ }
+ image_width=format.width;
+ image_height=format.height;
+ return result;
+}
+
+void Image::load_pcx(Input_File &target)
+{
+ unsigned long int x,y;
+ size_t index,position,line,length,repeat,chunk,plane;
+ unsigned char value;
+ const unsigned char *source;
+ const unsigned char *palette;
+ unsigned char *decoded;
+ IMG_Pixel pixel;
+ PCX_head head;
+ this->clear_buffer();
+ length=static_cast<size_t>(target.get_length());
+ source=target.get_view(0,length);
+ if ((source==NULL)||(length<128))
+ {
+  Halt("Incorrect image format");
+ }
+ memcpy(&head,source,128);
+ if ((head.compress!=1)||(head.color!=8)||(head.max_x<head.min_x)||(head.max_y<head.min_y))
+ {
+  Halt("Incorrect image format");
+ }
+ if ((head.planes!=1)&&(head.planes!=3)&&(head.planes!=4))
+ {
+  Halt("Incorrect image format");
+ }
+ width=head.max_x-head.min_x+1;
+ height=head.max_y-head.min_y+1;
+ if (head.plane_length<width)
+ {
+  Halt("Incorrect image format");
+ }
+ palette=NULL;
+ if (head.planes==1)
+ {
+  if ((length<128+769)||(source[length-769]!=12))
+  {
+   Halt("Incorrect image format");
+  }
+  palette=source+(length-768);
+  length-=769;
+ }
+ plane=head.plane_length;
+ line=static_cast<size_t>(head.planes)*plane;
+ decoded=this->create_buffer(line);
+ data=this->create_buffer(this->get_length());
+ index=128;
+ repeat=0;
+ value=0;
+ for (y=0;y<height;++y)
+ {
+  position=0;
+  while (position<line)
+  {
+   if (repeat==0)
+   {
+    if (index>=length)
+    {
+     Halt("Incorrect image format");
+    }
+    if (source[index]<192)
+    {
+     repeat=1;
+     value=source[index];
+     ++index;
+    }
+    else
+    {
+     if (index+1>=length)
+     {
+      Halt("Incorrect image format");
+     }
+     repeat=source[index]-192;
+     value=source[index+1];
+     index+=2;
+    }
+
+   }
+   chunk=repeat;
+   if (chunk>line-position)
+   {
+    chunk=line-position;
+   }
+   memset(decoded+position,value,chunk);
+   position+=chunk;
+   repeat-=chunk;
+  }
+  position=static_cast<size_t>(y)*static_cast<size_t>(width);
+  for (x=0;x<width;++x)
+  {
+   if (palette!=NULL)
+   {
+    pixel.red=palette[3*static_cast<size_t>(decoded[x])];
+    pixel.green=palette[3*static_cast<size_t>(decoded[x])+1];
+    pixel.blue=palette[3*static_cast<size_t>(decoded[x])+2];
+   }
+   else
+   {
+    pixel.red=decoded[x];
+    pixel.green=decoded[x+plane];
+    pixel.blue=decoded[x+2*plane];
+   }
+   this->store_pixel(position+static_cast<size_t>(x),pixel);
+  }
+
+ }
+ free(decoded);
+}
+
+void Image::load_tga(const char *name)
+{
+ Input_File target;
+ target.open_mapped(name);
+ this->load_tga(target);
+ target.close();
+}
+
+void Image::load_pcx(const char *name)
+{
+ Input_File target;
+ target.open_mapped(name);
+ this->load_pcx(target);
+ target.close();
+}
+
+unsigned long int Image::get_width() const
+{
+ return width;
+}
+
+unsigned long int Image::get_height() const
+{
+ return height;
+}
+
+size_t Image::get_length() const
+{
+ return static_cast<size_t>(width)*static_cast<size_t>(height)*this->get_pixel_size();
+}
+
+unsigned char *Image::get_data()
+{
+ return data;
+}
+
+void Image::set_transfer(const bool enabled)
+{
+ transfer=enabled;
+}
+
+bool Image::get_transfer() const
+{
+ return transfer;
+}
+
+void Image::set_packed(const bool enabled)
+{
+ packed=enabled;
+}
+
+bool Image::get_packed() const
+{
+ return packed;
+}
+
+void Image::set_shared(const bool enabled)
+{
+ shared=enabled;
+}
+
+bool Image::get_shared() const
+{
+ return shared;
+}
+
+void Image::set_cache(Asset_Cache *target)
+{
+ cache=target;
+}
+
+Asset_Cache *Image::get_cache() const
+{
+ return cache;
+}
+
+unsigned char *Image::release_data()
+{
+ unsigned char *result;
+ result=data;
+ data=NULL;
+ width=0;
+ height=0;
+ return result;
+}
+
+void Image::destroy_image()
+{
+ width=0;
+ height=0;
+ this->clear_buffer();
+}
+
+Sprite_Sheet::Sprite_Sheet()
+{
+ images=NULL;
+ frames=NULL;
+ index=NULL;
+ rows=NULL;
+ memset(&key,0,sizeof(IMG_Pixel));
+ kind=SINGLE_SPRITE;
+ amount=0;
+ columns=0;
+ frame_width=0;
+ frame_height=0;
+ prefetch=0;
+ stamp=0;
+ serial=0;
+ hits=0;
+ misses=0;
+ limit=SHEET_CACHE;
+ resident=0;
+}
+
+Sprite_Sheet::~Sprite_Sheet()
+{
+ this->clear_sheet();
+}
+
+void Sprite_Sheet::clear_sheet()
+{
+ if (images!=NULL)
+ {
+  delete[] images;
+  images=NULL;
+ }
+ if (frames!=NULL)
+ {
+  free(frames);
+  frames=NULL;
+ }
+ if (index!=NULL)
+ {
+  free(index);
+  index=NULL;
+ }
+ if (rows!=NULL)
+ {
+  free(rows);
+  rows=NULL;
+ }
+ source.close();
+ amount=0;
+ columns=0;
+ frame_width=0;
+ frame_height=0;
+ resident=0;
+}
+
+void Sprite_Sheet::create_frames()
+{
+ unsigned long int frame;
+ try
+ {
+  images=new Image[amount];
+ }
+ catch (...)
+ {
+  Halt("Can't allocate memory for sprite sheet");
+ }
+ frames=static_cast<SHEET_Frame*>(calloc(amount,sizeof(SHEET_Frame)));
+ rows=static_cast<TGA_Cursor*>(calloc(frame_height,sizeof(TGA_Cursor)));
+ if ((frames==NULL)||(rows==NULL))
+ {
+  Halt("Can't allocate memory for sprite sheet");
+ }
+ for (frame=0;frame<amount;++frame)
+ {
+  images[frame].set_shared(true);
+ }
+
+}
+
+void Sprite_Sheet::index_sheet(const SPRITE_TYPE target,const unsigned long int frames)
+{
+ Image parser;
+ unsigned long int width,height;
+ kind=target;
+ amount=1;
+ if ((kind!=SINGLE_SPRITE)&&(frames>1)) amount=frames;
+ columns=1;
+ if (kind==HORIZONTAL_STRIP) columns=amount;
+ index=parser.index_tga(source,columns,width,height);
+ frame_width=width;
+ frame_height=height;
+ if (kind==HORIZONTAL_STRIP) frame_width/=amount;
+ if (kind==VERTICAL_STRIP) frame_height/=amount;
+ if ((frame_width==0)||(frame_height==0))
+ {
+  Halt("Invalid image format");
+ }
+ this->create_frames();
+ this->decode_frame(1);
+ key=reinterpret_cast<IMG_Pixel*>(images[0].get_data())[0];
+}
+
+void Sprite_Sheet::check_frame(const unsigned long int target) const
+{
+ if ((target==0)||(target>amount))
+ {
+  Halt("Sprite sheet frame is out of range");
+ }
+
+}
+
+void Sprite_Sheet::evict_frames(const size_t keep)
+{
+ unsigned long int frame,victim;
+ while (resident>keep)
+ {
+  victim=0;
+  for (frame=1;frame<=amount;++frame)
+  {
+   if ((images[frame-1].get_data()==NULL)||(frames[frame-1].references>0)) continue;
+   if ((victim==0)||(frames[frame-1].stamp<frames[victim-1].stamp)) victim=frame;
+  }
+  if (victim==0) break;
+  images[victim-1].destroy_image();
+  --resident;
+ }
+
+}
+
+void Sprite_Sheet::decode_frame(const unsigned long int target)
+{
+ unsigned long int y;
+ const TGA_Cursor *target_rows;
+ this->evict_frames(limit-1);
+ target_rows=index+static_cast<size_t>(target-1)*static_cast<size_t>(frame_height);
+ if (kind==HORIZONTAL_STRIP)
+ {
+  for (y=0;y<frame_height;++y)
+  {
+   rows[y]=index[static_cast<size_t>(y)*static_cast<size_t>(columns)+target-1];
+  }
+  target_rows=rows;
+ }
+ images[target-1].load_tga(source,target_rows,frame_width,frame_height);
+ ++serial;
+ ++stamp;
+ frames[target-1].serial=serial;
+ frames[target-1].stamp=stamp;
+ ++resident;
+}
+
+void Sprite_Sheet::prefetch_frames(const unsigned long int target,const unsigned long int count)
+{
+ unsigned long int frame,step;
+ frame=target;
+ for (step=0;(step<count)&&(step<amount);++step)
+ {
+  if (images[frame-1].get_data()==NULL) this->decode_frame(frame);
+  ++frame;
+  if (frame>amount) frame=1;
+ }
+
+}
+
+void Sprite_Sheet::load_tga(const char *name,const SPRITE_TYPE target,const unsigned long int frames)
+{
+ this->clear_sheet();
+ source.open_mapped(name);
+ this->index_sheet(target,frames);
+}
+
+void Sprite_Sheet::load_tga(Pack_File &pack,const char *name,const SPRITE_TYPE target,const unsigned long int frames)
+{
+ this->clear_sheet();
+ pack.open_entry(name,source);
+ this->index_sheet(target,frames);
+}
+
+void Sprite_Sheet::set_cache_limit(const size_t frames)
+{
+ limit=frames;
+ if (limit==0) limit=1;
+ this->evict_frames(limit);
+}
+
+size_t Sprite_Sheet::get_cache_limit() const
+{
+ return limit;
+}
+
+void Sprite_Sheet::set_prefetch(const unsigned long int frames)
+{
+ prefetch=frames;
+}
+
+unsigned long int Sprite_Sheet::get_prefetch() const
+{
+ return prefetch;
+}
+
+void Sprite_Sheet::prefetch_frames(const unsigned long int target)
+{
+ unsigned long int count;
+ this->check_frame(target);
+ count=prefetch;
+ if (count>limit) count=limit;
+ this->prefetch_frames(target,count);
+}
+
+Image *Sprite_Sheet::get_frame(const unsigned long int target,unsigned long int &frame_serial)
+{
+ unsigned long int count,next;
+ this->check_frame(target);
+ if (images[target-1].get_data()==NULL)
+ {
+  ++misses;
+  this->decode_frame(target);
+  count=prefetch;
+  if (count>limit-1) count=limit-1;
+  next=target+1;
+  if (next>amount) next=1;
+  ++frames[target-1].references;
+  this->prefetch_frames(next,count);
+  --frames[target-1].references;
+ }
+ else
+ {
+  ++hits;
+ }
+ ++stamp;
+ frames[target-1].stamp=stamp;
+ frame_serial=frames[target-1].serial;
+ return images+target-1;
+}
+
+void Sprite_Sheet::retain_frame(const unsigned long int target)
+{
+ this->check_frame(target);
+ ++frames[target-1].references;
+}
+
+void Sprite_Sheet::release_frame(const unsigned long int target)
+{
+ if ((target>0)&&(target<=amount))
+ {
+  if (frames[target-1].references>0) --frames[target-1].references;
+ }
+
+}
+
+SPRITE_TYPE Sprite_Sheet::get_kind() const
+{
+ return kind;
+}
+
+IMG_Pixel Sprite_Sheet::get_key() const
+{
+ return key;
+}
+
+unsigned long int Sprite_Sheet::get_frames() const
+{
+ return amount;
+}
+
+unsigned long int Sprite_Sheet::get_frame_width() const
+{
+ return frame_width;
+}
+
+unsigned long int Sprite_Sheet::get_frame_height() const
+{
+ return frame_height;
+}
+
+size_t Sprite_Sheet::get_resident() const
+{
+ return resident;
+}
+
+unsigned long int Sprite_Sheet::get_hits() const
+{
+ return hits;
+}
+
+unsigned long int Sprite_Sheet::get_misses() const
+{
+ return misses;
+}
+
+void Sprite_Sheet::clear_cache()
+{
+ unsigned long int frame;
+ for (frame=0;frame<amount;++frame)
+ {
+  images[frame].destroy_image();
+ }
+ resident=0;
+}
+
+Sprite_Sheet* Sprite_Sheet::get_handle()
+{
+ return this;
+}
+
+Surface::Surface()
+{
+ width=0;
+ height=0;
+ pitch=0;
+ split=1;
+ revision=0;
+ image=NULL;
+ packed=NULL;
+ packed_buffer=NULL;
+ cached=NULL;
+ shared=false;
+ surface=NULL;
+}
+
+Surface::~Surface()
+{
+ surface=NULL;
+ this->release_cached();
+ if ((image!=NULL)&&(shared==false)) free(image);
+ if (packed_buffer!=NULL) free(packed_buffer);
+}
+
+void Surface::copy_pixel(IMG_Pixel *target,unsigned short int *target_packed,const size_t index,const size_t position) const
+{
+ if (packed!=NULL)
+ {
+  target_packed[index]=packed[position];
+ }
+ else
+ {
+  target[index]=image[position];
+ }
+
+}
+
+void Surface::release_cached()
+{
+ if (cached!=NULL)
+ {
+  cached->get_cache()->release_image(cached);
+  cached=NULL;
+ }
+
+}
+
+void Surface::replace_buffer(IMG_Pixel *buffer,unsigned short int *packed_target)
+{
+ if (packed!=NULL)
+ {
+  if (packed_buffer!=NULL) free(packed_buffer);
+  asset.close();
+  packed_buffer=packed_target;
+  packed=packed_target;
+ }
+ else
+ {
+  if (shared==false) free(image);
+  image=buffer;
+  shared=false;
+  this->release_cached();
+ }
+ ++revision;
+}
+
+size_t Surface::get_layout_offset(const unsigned long int x,const unsigned long int y,const unsigned long int amount) const
+{
+ unsigned long int block;
+ block=width/amount;
+ return static_cast<size_t>(x/block)*static_cast<size_t>(block)*static_cast<size_t>(height)+static_cast<size_t>(y)*static_cast<size_t>(block)+static_cast<size_t>(x%block);
+}
+
+void Surface::change_layout(const unsigned long int amount)
+{
+ unsigned long int x,y,unit,first,second,rest;
+ size_t size;
+ const unsigned char *source;
+ unsigned char *target;
+ IMG_Pixel *buffer;
+ unsigned short int *packed_target;
+ buffer=NULL;
+ packed_target=NULL;
+ if (packed!=NULL)
+ {
+  packed_target=this->create_packed_buffer(width,height);
+  source=reinterpret_cast<const unsigned char*>(packed);
+  target=reinterpret_cast<unsigned char*>(packed_target);
+  size=sizeof(unsigned short int);
+ }
+ else
+ {
+  buffer=this->create_buffer(width,height);
+  source=reinterpret_cast<const unsigned char*>(image);
+  target=reinterpret_cast<unsigned char*>(buffer);
+  size=3;
+ }
+ first=width/split;
+ second=width/amount;
+ while (second!=0)
+ {
+  rest=first%second;
+  first=second;
+  second=rest;
+ }
+ unit=first;
+ for (y=0;y<height;++y)
+ {
+  for (x=0;x<width;x+=unit)
+  {
+   memcpy(target+this->get_layout_offset(x,y,amount)*size,source+this->get_layout_offset(x,y,split)*size,static_cast<size_t>(unit)*size);
+  }
+
+ }
+ this->replace_buffer(buffer,packed_target);
+ this->set_split(amount);
+}
+
+IMG_Pixel *Surface::create_buffer(const unsigned long int image_width,const unsigned long int image_height)
+{
+ IMG_Pixel *result;
+ size_t length;
+ length=static_cast<size_t>(image_width)*static_cast<size_t>(image_height);
+ result=reinterpret_cast<IMG_Pixel*>(calloc(length,3));
+ if (result==NULL)
+ {
+  Halt("Can't allocate memory for image buffer");
+ }
+ return result;
+}
+
+unsigned short int *Surface::create_packed_buffer(const unsigned long int image_width,const unsigned long int image_height)
+{
+ unsigned short int *result;
+ size_t length;
+ length=static_cast<size_t>(image_width)*static_cast<size_t>(image_height);
+ result=static_cast<unsigned short int*>(calloc(length,sizeof(unsigned short int)));
+ if (result==NULL)
+ {
+  Halt("Can't allocate memory for image buffer");
+ }
+ return result;
+}
+
+void Surface::save()
+{
+ surface->save();
+}
+
+void Surface::restore()
+{
+ surface->restore();
+}
+
+void Surface::clear_buffer()
+{
+ if (image!=NULL)
+ {
+  if (shared==false) free(image);
+  image=NULL;
+ }
+ shared=false;
+ this->release_cached();
+ if (packed_buffer!=NULL)
+ {
+  free(packed_buffer);
+  packed_buffer=NULL;
+ }
+ packed=NULL;
+ asset.close();
+}
+
+void Surface::load_from_buffer(Image &buffer)
+{
+ Image *target;
+ if (buffer.get_packed()==true)
+ {
+  Halt("Packed image can't be loaded to surface");
+ }
+ target=NULL;
+ if ((buffer.get_shared()==true)&&(buffer.get_data()!=NULL)&&(buffer.get_cache()!=NULL))
+ {
+  target=&buffer;
+  target->get_cache()->retain_image(target);
+ }
+ width=buffer.get_width();
+ height=buffer.get_height();
+ this->set_split(1);
+ this->clear_buffer();
+ if ((buffer.get_shared()==true)&&(buffer.get_data()!=NULL))
+ {
+  image=reinterpret_cast<IMG_Pixel*>(buffer.get_data());
+  shared=true;
+  cached=target;
+ }
+ else if ((buffer.get_transfer()==true)&&(buffer.get_data()!=NULL))
+ {
+  image=reinterpret_cast<IMG_Pixel*>(buffer.release_data());
+ }
+ else
+ {
+  image=this->create_buffer(width,height);
+  memmove(image,buffer.get_data(),buffer.get_length());
+ }
+ ++revision;
+}
+
+void Surface::load_from_asset(AST_head &head)
+{
+ const unsigned char *source;
+ source=asset.get_view(0,ASSET_HEAD_LENGTH);
+ if (source==NULL)
+ {
+  Halt("Incorrect asset format");
+ }
+ memcpy(&head,source,ASSET_HEAD_LENGTH);
+ if ((strncmp(head.signature,"DAST",4)!=0)||(head.format!=ASSET_RGB565)||(head.width==0)||(head.height==0))
+ {
+  Halt("Incorrect asset format");
+ }
+ source=asset.get_view(head.pixels,static_cast<size_t>(head.width)*static_cast<size_t>(head.height)*sizeof(unsigned short int));
+ if ((source==NULL)||(head.pixels%sizeof(unsigned short int)!=0))
+ {
+  Halt("Incorrect asset format");
+ }
+ width=head.width;
+ height=head.height;
+ this->set_split(1);
+ packed=reinterpret_cast<const unsigned short int*>(source);
+ ++revision;
+}
+
+void Surface::load_from_asset(const char *name,AST_head &head)
+{
+ this->clear_buffer();
+ asset.open_mapped(name);
+ this->load_from_asset(head);
+}
+
+void Surface::load_from_asset(Pack_File &pack,const char *name,AST_head &head)
+{
+ this->clear_buffer();
+ pack.open_entry(name,asset);
+ this->load_from_asset(head);
+}
+
+const unsigned char *Surface::get_asset_view(const size_t offset,const size_t length) const
+{
+ return asset.get_view(offset,length);
+}
+
+void Surface::set_width(const unsigned long int image_width)
+{
+ width=image_width;
+ this->set_split(1);
+}
+
+void Surface::set_height(const unsigned long int image_height)
+{
+ height=image_height;
+}
+
+void Surface::set_buffer(IMG_Pixel *buffer)
+{
+ image=buffer;
+ ++revision;
+}
+
+void Surface::set_packed_buffer(unsigned short int *buffer)
+{
+ packed_buffer=buffer;
+ packed=buffer;
+ ++revision;
+}
+
+void Surface::split_frames(const unsigned long int amount)
+{
+ unsigned long int target;
+ target=amount;
+ if ((target==0)||(width<target)) target=1;
+ if (width%target!=0) target=1;
+ if ((image==NULL)&&(packed==NULL)) target=split;
+ if ((split==1)&&((shared==true)||((packed!=NULL)&&(packed_buffer==NULL)))) target=1;
+ if (target!=split) this->change_layout(target);
+}
+
+void Surface::set_split(const unsigned long int amount)
+{
+ split=amount;
+ pitch=width/split;
+}
+
+unsigned long int Surface::get_split() const
+{
+ return split;
+}
+
+unsigned long int Surface::get_pitch() const
+{
+ return pitch;
+}
+
+size_t Surface::get_offset(const unsigned long int start,const unsigned long int x,const unsigned long int y,const unsigned long int target_width)
+{
+ return static_cast<size_t>(start)+static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(target_width);
+}
+
+size_t Surface::get_offset(const unsigned long int start,const unsigned long int x,const unsigned long int y) const
+{
+ return static_cast<size_t>(start)+static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(pitch);
+}
+
+void Surface::draw_image_pixel(const size_t offset,const unsigned long int x,const unsigned long int y)
+{
+ if (packed!=NULL)
+ {
+  surface->draw_pixel(x,y,packed[offset]);
+ }
+ else
+ {
+  surface->draw_pixel(x,y,image[offset].red,image[offset].green,image[offset].blue);
+ }
+
+}
+
+bool Surface::compare_pixels(const size_t first,const size_t second) const
+{
+ bool result;
+ result=false;
+ if (packed!=NULL)
+ {
+  result=(packed[first]!=packed[second]);
+  goto finish;
+ }
+ if (image[first].red!=image[second].red)
+ {
+  result=true;
+  goto finish;
+ }
+ if (image[first].green!=image[second].green)
+ {
+  result=true;
+  goto finish;
+ }
+ if (image[first].blue!=image[second].blue)
+ {
+  result=true;
+  goto finish;
+ }
+ finish: ;
+ return result;
+}
+
+unsigned long int Surface::get_surface_width() const
+{
+ return surface->get_frame_width();
+}
+
+unsigned long int Surface::get_surface_height() const
+{
+ return surface->get_frame_height();
+}
+
+unsigned short int *Surface::get_surface_buffer()
+{
+ return surface->get_buffer();
+}
+
+unsigned long int Surface::get_revision() const
+{
+ return revision;
+}
+
+void Surface::initialize(Screen *screen)
+{
+ surface=screen;
+}
+
+size_t Surface::get_length() const
+{
+ size_t result;
+ result=static_cast<size_t>(width)*static_cast<size_t>(height)*3;
+ if (packed!=NULL)
+ {
+  result=static_cast<size_t>(width)*static_cast<size_t>(height)*sizeof(unsigned short int);
+ }
+ return result;
+}
+
+IMG_Pixel *Surface::get_image()
+{
+ return image;
+}
+
+const unsigned short int *Surface::get_packed_image() const
+{
+ return packed;
+}
+
+bool Surface::check_packed() const
+{
+ return packed!=NULL;
+}
+
+unsigned long int Surface::get_image_width() const
+{
+ return width;
+}
+
+unsigned long int Surface::get_image_height() const
+{
+ return height;
+}
+
+void Surface::mirror_image(const MIRROR_TYPE kind)
+{
+ unsigned long int x,y,index,amount;
+ IMG_Pixel *mirrored_image;
+ unsigned short int *mirrored_packed;
+ amount=split;
+ if (split!=1) this->change_layout(1);
+ x=0;
+ y=0;
+ mirrored_image=NULL;
+ mirrored_packed=NULL;
+ if (packed!=NULL)
+ {
+  mirrored_packed=this->create_packed_buffer(width,height);
+ }
+ else
+ {
+  mirrored_image=this->create_buffer(width,height);
+ }
+ if (kind==MIRROR_HORIZONTAL)
+ {
+  for (index=width*height;index>0;--index)
+  {
+   this->copy_pixel(mirrored_image,mirrored_packed,this->get_offset(0,x,y),this->get_offset(0,(width-x-1),y));
+   ++x;
+   if (x==width)
+   {
+    x=0;
+    ++y;
+   }
+
+  }
+
+ }
+ if (kind==MIRROR_VERTICAL)
+ {
+  for (index=width*height;index>0;--index )
+  {
+   this->copy_pixel(mirrored_image,mirrored_packed,this->get_offset(0,x,y),this->get_offset(0,x,(height-y-1)));
+   ++x;
+   if (x==width)
+   {
+    x=0;
+    ++y;
+   }
+
+  }
+
+ }
+ this->replace_buffer(mirrored_image,mirrored_packed);
+ this->split_frames(amount);
+}
+
+void Surface::resize_image(const unsigned long int new_width,const unsigned long int new_height)
+{
+ float x_ratio,y_ratio;
+ unsigned long int x,y;
+ size_t index,position;
+ IMG_Pixel *scaled_image;
+ unsigned short int *scaled_packed;
+ if (split!=1) this->change_layout(1);
+ scaled_image=NULL;
+ scaled_packed=NULL;
+ if (packed!=NULL)
+ {
+  scaled_packed=this->create_packed_buffer(new_width,new_height);
+ }
+ else
+ {
+  scaled_image=this->create_buffer(new_width,new_height);
+ }
+ x_ratio=static_cast<float>(width)/static_cast<float>(new_width);
+ y_ratio=static_cast<float>(height)/static_cast<float>(new_height);
+ for (x=0;x<new_width;++x)
+ {
+  for (y=0;y<new_height;++y)
+  {
+   index=this->get_offset(0,x,y,new_width);
+   position=this->get_offset(0,(x_ratio*static_cast<float>(x)),(y_ratio*static_cast<float>(y)),width);
+   this->copy_pixel(scaled_image,scaled_packed,index,position);
+  }
+
+ }
+ this->replace_buffer(scaled_image,scaled_packed);
+ width=new_width;
+ height=new_height;
+ this->set_split(1);
+}
+
+void Surface::horizontal_mirror()
+{
+ this->mirror_image(MIRROR_HORIZONTAL);
+}
+
+void Surface::vertical_mirror()
+{
+ this->mirror_image(MIRROR_VERTICAL);
+}
+
+Canvas::Canvas()
+{
+ start=0;
+ frame=1;
+ frames=1;
+}
+
+Canvas::~Canvas()
+{
+
+}
+
+void Canvas::set_frame(const unsigned long int target)
+{
+ if (target>0)
+ {
+  if (target<=frames) frame=target;
+ }
+
+}
+
+void Canvas::increase_frame()
+{
+ ++frame;
+ if (frame>frames)
+ {
+  frame=1;
+ }
+
+}
+
+void Canvas::set_frames(const unsigned long int amount)
+{
+ if (amount>1) frames=amount;
+ if (frame>frames) frame=1;
+}
+
+unsigned long int Canvas::get_frames() const
+{
+ return frames;
+}
+
+unsigned long int Canvas::get_frame() const
+{
+ return frame;
+}
+
+void Canvas::load_image(Image &buffer)
+{
+ this->load_from_buffer(buffer);
+}
+
+Background::Background()
+{
+ background_width=0;
+ background_height=0;
+ maximum_width=0;
+ maximum_height=0;
+ current=0;
+ current_kind=NORMAL_BACKGROUND;
+ cache=NULL;
+ cache_amount=0;
+ cache_limit=BACKGROUND_CACHE;
+ cache_width=0;
+ cache_height=0;
+ cache_revision=0;
+ cache_stamp=0;
+ hits=0;
+ misses=0;
+ cache_kind=NORMAL_BACKGROUND;
+}
+
+Background::~Background()
+{
+ this->clear_cache();
+}
+
+void Background::get_maximum_width()
+{
+ maximum_width=background_width;
+ if (maximum_width>this->get_surface_width())
+ {
+  maximum_width=this->get_surface_width();
+ }
+
+}
+
+void Background::get_maximum_height()
+{
+ maximum_height=background_height;
+ if (maximum_height>this->get_surface_height())
+ {
+  maximum_height=this->get_surface_height();
+ }
+
+}
+
+void Background::slow_draw_background()
+{
+ unsigned long int x,y,index;
+ x=0;
+ y=0;
+ for (index=maximum_width*maximum_height;index>0;--index)
+ {
+  this->draw_image_pixel(this->get_offset(start,x,y),x,y);
+  ++x;
+  if (x==maximum_width)
+  {
+   x=0;
+   ++y;
+  }
+
+ }
+
+}
+
+void Background::configure_background()
+{
+ switch(current_kind)
+ {
+  case NORMAL_BACKGROUND:
+  background_width=this->get_image_width();
+  background_height=this->get_image_height();
+  this->split_frames(1);
+  start=0;
+  break;
+  case HORIZONTAL_BACKGROUND:
+  background_width=this->get_image_width()/this->get_frames();
+  background_height=this->get_image_height();
+  this->split_frames(this->get_frames());
+  start=(this->get_frame()-1)*background_width;
+  if (this->get_split()>1) start*=background_height;
+  break;
+  case VERTICAL_BACKGROUND:
+  background_width=this->get_image_width();
+  background_height=this->get_image_height()/this->get_frames();
+  this->split_frames(1);
+  start=(this->get_frame()-1)*background_width*background_height;
+  break;
+ }
+
+}
+
+void Background::create_cache()
+{
+ size_t index,length;
+ length=static_cast<size_t>(maximum_width)*static_cast<size_t>(maximum_height)*sizeof(unsigned short int);
+ cache_amount=0;
+ if (length>0) cache_amount=cache_limit/length;
+ if (cache_amount>this->get_frames()) cache_amount=this->get_frames();
+ if (cache_amount>0)
+ {
+  cache=static_cast<BG_Frame*>(calloc(cache_amount,sizeof(BG_Frame)));
+  if (cache==NULL)
+  {
+   Halt("Can't allocate memory for background cache");
+  }
+  for (index=0;index<cache_amount;++index)
+  {
+   cache[index].pixels=NULL;
+   cache[index].frame=0;
+   cache[index].stamp=0;
+  }
+
+ }
+ cache_width=maximum_width;
+ cache_height=maximum_height;
+ cache_revision=this->get_revision();
+ cache_kind=current_kind;
+}
+
+void Background::prepare_cache()
+{
+ if ((cache_width!=maximum_width)||(cache_height!=maximum_height)||(cache_revision!=this->get_revision())||(cache_kind!=current_kind))
+ {
+  this->clear_cache();
+ }
+ if (cache==NULL) this->create_cache();
+}
+
+BG_Frame *Background::get_cached_frame()
+{
+ size_t index;
+ BG_Frame *target;
+ target=NULL;
+ for (index=0;index<cache_amount;++index)
+ {
+  if (cache[index].frame==this->get_frame())
+  {
+   target=cache+index;
+   ++hits;
+   break;
+  }
+
+ }
+ if (target==NULL)
+ {
+  ++misses;
+  target=cache;
+  for (index=1;index<cache_amount;++index)
+  {
+   if (cache[index].stamp<target->stamp) target=cache+index;
+  }
+  if (target->pixels==NULL)
+  {
+   target->pixels=static_cast<unsigned short int*>(calloc(static_cast<size_t>(maximum_width)*static_cast<size_t>(maximum_height),sizeof(unsigned short int)));
+   if (target->pixels==NULL)
+   {
+    Halt("Can't allocate memory for background cache");
+   }
+
+  }
+  this->fill_cached_frame(target->pixels);
+  target->frame=this->get_frame();
+ }
+ ++cache_stamp;
+ target->stamp=cache_stamp;
+ return target;
+}
+
+void Background::fill_cached_frame(unsigned short int *target)
+{
+ unsigned long int x,y;
+ size_t offset;
+ IMG_Pixel *image;
+ image=this->get_image();
+ for (y=0;y<maximum_height;++y)
+ {
+  for (x=0;x<maximum_width;++x)
+  {
+   offset=this->get_offset(start,x,y);
+   target[x]=pack_pixel(image[offset].red,image[offset].green,image[offset].blue);
+  }
+  target+=maximum_width;
+ }
+
+}
+
+void Background::draw_cached_frame(const unsigned short int *source)
+{
+ unsigned long int y,surface_width;
+ unsigned short int *target;
+ surface_width=this->get_surface_width();
+ target=this->get_surface_buffer();
+ if (maximum_width==surface_width)
+ {
+  memcpy(target,source,static_cast<size_t>(maximum_width)*static_cast<size_t>(maximum_height)*sizeof(unsigned short int));
+ }
+ else
+ {
+  for (y=0;y<maximum_height;++y)
+  {
+   memcpy(target,source,static_cast<size_t>(maximum_width)*sizeof(unsigned short int));
+   target+=surface_width;
+   source+=maximum_width;
+  }
+
+ }
+
+}
+
+unsigned long int Background::get_width() const
+{
+ return background_width;
+}
+
+unsigned long int Background::get_height() const
+{
+ return background_height;
+}
+
+void Background::set_kind(const BACKGROUND_TYPE kind)
+{
+ current_kind=kind;
+ this->configure_background();
+ this->get_maximum_width();
+ this->get_maximum_height();
+}
+
+void Background::set_setting(const BACKGROUND_TYPE kind,const unsigned long int frames)
+{
+ if (kind!=NORMAL_BACKGROUND) this->set_frames(frames);
+ this->set_kind(kind);
+}
+
+void Background::set_target(const unsigned long int target)
+{
+ this->set_frame(target);
+ this->set_kind(current_kind);
+}
+
+void Background::step()
+{
+ this->increase_frame();
+ this->set_kind(current_kind);
+}
+
+void Background::set_cache_limit(const size_t limit)
+{
+ this->clear_cache();
+ cache_limit=limit;
+}
+
+size_t Background::get_cache_limit() const
+{
+ return cache_limit;
+}
+
+void Background::clear_cache()
+{
+ size_t index;
+ if (cache!=NULL)
+ {
+  for (index=0;index<cache_amount;++index)
+  {
+   if (cache[index].pixels!=NULL) free(cache[index].pixels);
+  }
+  free(cache);
+  cache=NULL;
+ }
+ cache_amount=0;
+}
+
+unsigned long int Background::get_cache_hits() const
+{
+ return hits;
+}
+
+unsigned long int Background::get_cache_misses() const
+{
+ return misses;
+}
+
+void Background::draw_background()
+{
+ if (current!=this->get_frame())
+ {
+  this->prepare_cache();
+  if (cache_amount>0)
+  {
+   this->draw_cached_frame(this->get_cached_frame()->pixels);
+  }
+  else
+  {
+   ++misses;
+   this->slow_draw_background();
+  }
+  this->save();
+  current=this->get_frame();
+ }
+ else
+ {
+  this->restore();
+ }
+
+}
+
+Layer::Layer()
+{
+ transparent=false;
+ offset_x=0;
+ offset_y=0;
+ factor=100;
+ layer_revision=0;
+ pixels=NULL;
+ rows=NULL;
+ spans=NULL;
+}
+
+Layer::~Layer()
+{
+ this->clear_layer();
+}
+
+void Layer::clear_layer()
+{
+ if (pixels!=NULL)
+ {
+  free(pixels);
+  pixels=NULL;
+ }
+ if (rows!=NULL)
+ {
+  free(rows);
+  rows=NULL;
+ }
+ if (spans!=NULL)
+ {
+  free(spans);
+  spans=NULL;
+ }
+
+}
+
+void Layer::create_pixels()
+{
+ size_t index,length;
+ IMG_Pixel *image;
+ image=this->get_image();
+ length=static_cast<size_t>(this->get_image_width())*static_cast<size_t>(this->get_image_height());
+ pixels=static_cast<unsigned short int*>(calloc(length,sizeof(unsigned short int)));
+ if (pixels==NULL)
+ {
+  Halt("Can't allocate memory for layer buffer");
+ }
+ for (index=0;index<length;++index)
+ {
+  pixels[index]=pack_pixel(image[index].red,image[index].green,image[index].blue);
+ }
+
+}
+
+void Layer::create_spans()
+{
+ unsigned long int x,y,width,height;
+ size_t amount,index;
+ width=this->get_image_width();
+ height=this->get_image_height();
+ rows=static_cast<size_t*>(calloc(static_cast<size_t>(height)+1,sizeof(size_t)));
+ if (rows==NULL)
+ {
+  Halt("Can't allocate memory for layer spans");
+ }
+ amount=0;
+ for (y=0;y<height;++y)
+ {
+  for (x=0;x<width;++x)
+  {
+   if (this->compare_pixels(0,this->get_offset(0,x,y))==true)
+   {
+    if ((x==0)||(this->compare_pixels(0,this->get_offset(0,x-1,y))==false)) ++amount;
+   }
+
+  }
+
+ }
+ spans=static_cast<IMG_Span*>(calloc(amount+1,sizeof(IMG_Span)));
+ if (spans==NULL)
+ {
+  Halt("Can't allocate memory for layer spans");
+ }
+ index=0;
+ for (y=0;y<height;++y)
+ {
+  rows[y]=index;
+  for (x=0;x<width;++x)
+  {
+   if (this->compare_pixels(0,this->get_offset(0,x,y))==true)
+   {
+    if ((x==0)||(this->compare_pixels(0,this->get_offset(0,x-1,y))==false))
+    {
+     spans[index].start=x;
+     spans[index].length=0;
+     ++index;
+    }
+    ++spans[index-1].length;
+   }
+
+  }
+
+ }
+ rows[height]=index;
+}
+
+void Layer::prepare_layer()
+{
+ if (layer_revision!=this->get_revision())
+ {
+  this->clear_layer();
+  if (this->get_image()!=NULL)
+  {
+   this->create_pixels();
+   this->create_spans();
+  }
+  layer_revision=this->get_revision();
+ }
+
+}
+
+unsigned long int Layer::wrap_offset(const unsigned long int offset,const long long int delta,const unsigned long int size) const
+{
+ long long int shift;
+ unsigned long int result;
+ result=offset;
+ if (size>0)
+ {
+  shift=delta%static_cast<long long int>(size);
+  if (shift<0) shift+=size;
+  result=(offset%size+static_cast<unsigned long int>(shift))%size;
+ }
+ return result;
+}
+
+long long int Layer::get_camera_shift(const long int camera) const
+{
+ long long int shift;
+ shift=static_cast<long long int>(camera)*factor;
+ if ((shift<0)&&(shift%100!=0))
+ {
+  shift=shift/100-1;
+ }
+ else
+ {
+  shift/=100;
+ }
+ return shift;
+}
+
+void Layer::draw_row(unsigned short int *target,const size_t row,const unsigned long int shift,const unsigned long int length)
+{
+ unsigned long int x,source,amount,width;
+ width=this->get_image_width();
+ source=shift;
+ for (x=0;x<length;x+=amount)
+ {
+  amount=width-source;
+  if (amount>length-x) amount=length-x;
+  memcpy(target+x,pixels+row*static_cast<size_t>(width)+source,static_cast<size_t>(amount)*sizeof(unsigned short int));
+  source=0;
+ }
+
+}
+
+void Layer::draw_transparent_row(unsigned short int *target,const size_t row,const unsigned long int shift,const unsigned long int length)
+{
+ unsigned long int x,source,amount,width,start,stop;
+ size_t index;
+ width=this->get_image_width();
+ source=shift;
+ for (x=0;x<length;x+=amount)
+ {
+  amount=width-source;
+  if (amount>length-x) amount=length-x;
+  for (index=rows[row];index<rows[row+1];++index)
+  {
+   start=spans[index].start;
+   stop=start+spans[index].length;
+   if (start<source) start=source;
+   if (stop>source+amount) stop=source+amount;
+   if (start<stop)
+   {
+    memcpy(target+x+(start-source),pixels+row*static_cast<size_t>(width)+start,static_cast<size_t>(stop-start)*sizeof(unsigned short int));
+   }
+
+  }
+  source=0;
+ }
+
+}
+
+void Layer::load_layer(Image &buffer)
+{
+ this->load_from_buffer(buffer);
+ this->prepare_layer();
+ offset_x=this->wrap_offset(offset_x,0,this->get_image_width());
+ offset_y=this->wrap_offset(offset_y,0,this->get_image_height());
+}
+
+void Layer::set_transparent(const bool enabled)
+{
+ transparent=enabled;
+}
+
+bool Layer::get_transparent() const
+{
+ return transparent;
+}
+
+void Layer::set_parallax(const unsigned long int percent)
+{
+ factor=percent;
+}
+
+unsigned long int Layer::get_parallax() const
+{
+ return factor;
+}
+
+void Layer::set_offset(const unsigned long int x,const unsigned long int y)
+{
+ offset_x=this->wrap_offset(x,0,this->get_image_width());
+ offset_y=this->wrap_offset(y,0,this->get_image_height());
+}
+
+void Layer::scroll(const long int x,const long int y)
+{
+ offset_x=this->wrap_offset(offset_x,x,this->get_image_width());
+ offset_y=this->wrap_offset(offset_y,y,this->get_image_height());
+}
+
+unsigned long int Layer::get_offset_x() const
+{
+ return offset_x;
+}
+
+unsigned long int Layer::get_offset_y() const
+{
+ return offset_y;
+}
+
+void Layer::draw_layer(const long int camera_x,const long int camera_y)
+{
+ unsigned long int y,row,shift,width,height,screen_width,screen_height;
+ unsigned short int *target;
+ this->prepare_layer();
+ width=this->get_image_width();
+ height=this->get_image_height();
+ if ((pixels!=NULL)&&(width>0)&&(height>0))
+ {
+  screen_width=this->get_surface_width();
+  screen_height=this->get_surface_height();
+  target=this->get_surface_buffer();
+  shift=this->wrap_offset(offset_x,this->get_camera_shift(camera_x),width);
+  row=this->wrap_offset(offset_y,this->get_camera_shift(camera_y),height);
+  for (y=0;y<screen_height;++y)
+  {
+   if (transparent==true)
+   {
+    this->draw_transparent_row(target,row,shift,screen_width);
+   }
+   else
+   {
+    this->draw_row(target,row,shift,screen_width);
+   }
+   target+=screen_width;
+   ++row;
+   if (row==height) row=0;
+  }
+
+ }
+
+}
+
+Layer* Layer::get_handle()
+{
+ return this;
+}
+
+Parallax::Parallax()
+{
+ size_t index;
+ for (index=0;index<PARALLAX_LAYERS;++index)
+ {
+  layers[index]=NULL;
+ }
+ amount=0;
+ camera_x=0;
+ camera_y=0;
+}
+
+Parallax::~Parallax()
+{
+
+}
+
+void Parallax::add_layer(Layer *target)
+{
+ if (amount==PARALLAX_LAYERS)
+ {
+  Halt("Too many parallax layers");
+ }
+ layers[amount]=target;
+ ++amount;
+}
+
+void Parallax::clear_layers()
+{
+ while (amount>0)
+ {
+  --amount;
+  layers[amount]=NULL;
+ }
+
+}
+
+size_t Parallax::get_layers() const
+{
+ return amount;
+}
+
+void Parallax::set_camera(const long int x,const long int y)
+{
+ camera_x=x;
+ camera_y=y;
+}
+
+long int Parallax::get_camera_x() const
+{
+ return camera_x;
+}
+
+long int Parallax::get_camera_y() const
+{
+ return camera_y;
+}
+
+void Parallax::draw_parallax()
+{
+ size_t index;
+ for (index=0;index<amount;++index)
+ {
+  layers[index]->draw_layer(camera_x,camera_y);
+ }
+
+}
+
+Sprite::Sprite()
+{
+ transparent=true;
+ current_x=0;
+ current_y=0;
+ sprite_width=0;
+ sprite_height=0;
+ mask_width=0;
+ mask_height=0;
+ mask_frames=0;
+ mask_revision=0;
+ mirror=0;
+ mask_length=0;
+ masks[0]=NULL;
+ masks[1]=NULL;
+ masks[2]=NULL;
+ masks[3]=NULL;
+ asset_rows=NULL;
+ asset_spans=NULL;
+ asset_masks=NULL;
+ asset_width=0;
+ asset_height=0;
+ asset_frames=0;
+ asset_revision=0;
+ sheet=NULL;
+ sheet_serial=0;
+ sheet_mirror=0;
+ sheet_frame=0;
+ current_kind=SINGLE_SPRITE;
+}
+
+Sprite::~Sprite()
+{
+ this->release_sheet();
+ this->clear_masks();
+}
+
+bool Sprite::check_asset() const
+{
+ bool result;
+ result=false;
+ if ((this->check_packed()==true)&&(asset_revision==this->get_revision()))
+ {
+  if ((sprite_width==asset_width)&&(sprite_height==asset_height))
+  {
+   result=(current_kind==SINGLE_SPRITE)||(this->get_frames()==asset_frames);
+  }
+
+ }
+ return result;
+}
+
+void Sprite::release_sheet()
+{
+ if ((sheet!=NULL)&&(sheet_frame!=0)) sheet->release_frame(sheet_frame);
+ sheet=NULL;
+ sheet_frame=0;
+}
+
+void Sprite::load_sheet_frame()
+{
+ Image *target;
+ unsigned long int frame,serial;
+ frame=1;
+ if (sheet->get_kind()!=SINGLE_SPRITE) frame=this->get_frame();
+ target=sheet->get_frame(frame,serial);
+ if (frame!=sheet_frame)
+ {
+  sheet->retain_frame(frame);
+  if (sheet_frame!=0) sheet->release_frame(sheet_frame);
+  sheet_frame=frame;
+ }
+ if ((serial!=sheet_serial)||(this->get_image()==NULL))
+ {
+  this->load_from_buffer(*target);
+  if ((sheet_mirror&1)!=0) this->Surface::mirror_image(MIRROR_HORIZONTAL);
+  if ((sheet_mirror&2)!=0) this->Surface::mirror_image(MIRROR_VERTICAL);
+  sheet_serial=serial;
+ }
+ current_kind=sheet->get_kind();
+ sprite_width=this->get_image_width();
+ sprite_height=this->get_image_height();
+ start=0;
+}
+
+bool Sprite::check_visible(const size_t offset)
+{
+ bool result;
+ IMG_Pixel pixel,color;
+ if (sheet!=NULL)
+ {
+  pixel=this->get_image()[offset];
+  color=sheet->get_key();
+  result=(pixel.red!=color.red)||(pixel.green!=color.green)||(pixel.blue!=color.blue);
+ }
+ else
+ {
+  result=this->compare_pixels(0,offset);
+ }
+ return result;
+}
+
+unsigned long int Sprite::get_mask_frame() const
+{
+ unsigned long int result;
+ result=this->get_frame();
+ if ((current_kind==SINGLE_SPRITE)||(sheet!=NULL)) result=1;
+ return result;
+}
+
+void Sprite::draw_packed_sprite()
+{
+ unsigned long int y,length,frame_width,frame_height;
+ unsigned short int *target;
+ const unsigned short int *source;
+ frame_width=this->get_surface_width();
+ frame_height=this->get_surface_height();
+ if ((current_x<frame_width)&&(current_y<frame_height))
+ {
+  length=sprite_width;
+  if (length>frame_width-current_x) length=frame_width-current_x;
+  target=this->get_surface_buffer()+this->get_offset(current_x,0,current_y,frame_width);
+  source=this->get_packed_image()+start;
+  for (y=0;(y<sprite_height)&&(y<frame_height-current_y);++y)
+  {
+   memcpy(target,source,static_cast<size_t>(length)*sizeof(unsigned short int));
+   target+=frame_width;
+   source+=this->get_pitch();
+  }
+
+ }
+
+}
+
+void Sprite::draw_packed_spans()
+{
+ unsigned long int y,x,length,amount,frame_width,frame_height;
+ size_t row,span,stop;
+ unsigned short int *target;
+ const unsigned short int *source;
+ frame_width=this->get_surface_width();
+ frame_height=this->get_surface_height();
+ if ((current_x<frame_width)&&(current_y<frame_height))
+ {
+  length=sprite_width;
+  if (length>frame_width-current_x) length=frame_width-current_x;
+  row=0;
+  if (current_kind!=SINGLE_SPRITE) row=static_cast<size_t>(this->get_frame()-1)*static_cast<size_t>(sprite_height);
+  target=this->get_surface_buffer()+this->get_offset(current_x,0,current_y,frame_width);
+  source=this->get_packed_image()+start;
+  for (y=0;(y<sprite_height)&&(y<frame_height-current_y);++y)
+  {
+   stop=asset_rows[row+y].start+asset_rows[row+y].length;
+   for (span=asset_rows[row+y].start;span<stop;++span)
+   {
+    x=asset_spans[span].start;
+    if (x<length)
+    {
+     amount=asset_spans[span].length;
+     if (amount>length-x) amount=length-x;
+     memcpy(target+x,source+x,static_cast<size_t>(amount)*sizeof(unsigned short int));
+    }
+
+   }
+   target+=frame_width;
+   source+=this->get_pitch();
+  }
+
+ }
+
+}
+
+void Sprite::draw_transparent_sprite()
+{
+ unsigned long int x,y,index;
+ x=0;
+ y=0;
+ for (index=sprite_width*sprite_height;index>0;--index)
+ {
+  if (this->check_visible(this->get_offset(start,x,y))==true)
+  {
+   this->draw_image_pixel(this->get_offset(start,x,y),x+current_x,y+current_y);
+  }
+  ++x;
+  if (x==sprite_width)
+  {
+   x=0;
+   ++y;
+  }
+
+ }
+
+}
+
+void Sprite::draw_normal_sprite()
+{
+ unsigned long int x,y,index;
+ x=0;
+ y=0;
+ for (index=sprite_width*sprite_height;index>0;--index)
+ {
+  this->draw_image_pixel(this->get_offset(start,x,y),x+current_x,y+current_y);
+  ++x;
+  if (x==sprite_width)
+  {
+   x=0;
+   ++y;
+  }
+
+ }
+
+}
+
+size_t Sprite::get_frame_offset(const unsigned long int target) const
+{
+ size_t offset;
+ offset=0;
+ switch(current_kind)
+ {
+  case SINGLE_SPRITE:
+  offset=0;
+  break;
+  case HORIZONTAL_STRIP:
+  offset=static_cast<size_t>(target-1)*static_cast<size_t>(sprite_width);
+  if (this->get_split()>1) offset*=static_cast<size_t>(sprite_height);
+  break;
+  case VERTICAL_STRIP:
+  offset=static_cast<size_t>(target-1)*static_cast<size_t>(sprite_width)*static_cast<size_t>(sprite_height);
+  break;
+ }
+ return offset;
+}
+
+void Sprite::clear_masks()
+{
+ size_t index;
+ for (index=0;index<4;++index)
+ {
+  if (masks[index]!=NULL)
+  {
+   free(masks[index]);
+   masks[index]=NULL;
+  }
+
+ }
+
+}
+
+void Sprite::create_mask(unsigned long int *target,const size_t offset)
+{
+ unsigned long int x,y;
+ size_t row;
+ row=(static_cast<size_t>(sprite_width)+MASK_BITS-1)/MASK_BITS;
+ for (y=0;y<sprite_height;++y)
+ {
+  for (x=0;x<sprite_width;++x)
+  {
+   if (this->check_visible(offset+this->get_offset(0,x,y))==true)
+   {
+    target[static_cast<size_t>(y)*row+x/MASK_BITS]|=1UL<<(x%MASK_BITS);
+   }
+
+  }
+
+ }
+
+}
+
+void Sprite::create_masks()
+{
+ unsigned long int frame,frames;
+ frames=mask_frames;
+ masks[mirror]=static_cast<unsigned long int*>(calloc(mask_length*static_cast<size_t>(frames),sizeof(unsigned long int)));
+ if (masks[mirror]==NULL)
+ {
+  Halt("Can't allocate memory for collision mask");
+ }
+ for (frame=1;frame<=frames;++frame)
+ {
+  this->create_mask(masks[mirror]+mask_length*static_cast<size_t>(frame-1),this->get_frame_offset(frame));
+ }
+
+}
+
+void Sprite::prepare_masks()
+{
+ unsigned long int frames;
+ frames=this->get_frames();
+ if ((current_kind==SINGLE_SPRITE)||(sheet!=NULL)) frames=1;
+ if (((this->get_image()!=NULL)||(this->check_packed()==true))&&(sprite_width>0)&&(sprite_height>0))
+ {
+  if ((mask_revision!=this->get_revision())||(mask_width!=sprite_width)||(mask_height!=sprite_height)||(mask_frames!=frames))
+  {
+   this->clear_masks();
+   mirror=0;
+   mask_width=sprite_width;
+   mask_height=sprite_height;
+   mask_frames=frames;
+   mask_revision=this->get_revision();
+   mask_length=((static_cast<size_t>(sprite_width)+MASK_BITS-1)/MASK_BITS)*static_cast<size_t>(sprite_height);
+  }
+  if ((masks[mirror]==NULL)&&((mirror!=0)||(asset_masks==NULL)||(this->check_asset()==false))) this->create_masks();
+ }
+
+}
+
+void Sprite::load_sprite(Image &buffer,const SPRITE_TYPE kind,const unsigned long int frames)
+{
+ this->release_sheet();
+ this->load_image(buffer);
+ if (kind!=SINGLE_SPRITE) this->set_frames(frames);
+ this->set_kind(kind);
+}
+
+void Sprite::read_asset(AST_head &head)
+{
+ size_t index,amount,length;
+ this->release_sheet();
+ if ((head.kind>VERTICAL_STRIP)||(head.frames==0))
+ {
+  Halt("Incorrect asset format");
+ }
+ asset_rows=NULL;
+ asset_spans=NULL;
+ asset_masks=NULL;
+ asset_width=head.width;
+ asset_height=head.height;
+ asset_frames=1;
+ if (head.kind!=SINGLE_SPRITE) asset_frames=head.frames;
+ if (head.kind==HORIZONTAL_STRIP) asset_width/=asset_frames;
+ if (head.kind==VERTICAL_STRIP) asset_height/=asset_frames;
+ if ((asset_width==0)||(asset_height==0))
+ {
+  Halt("Incorrect asset format");
+ }
+ if ((head.flags&ASSET_SPLIT)!=0)
+ {
+  if ((head.kind!=HORIZONTAL_STRIP)||(head.width%asset_frames!=0))
+  {
+   Halt("Incorrect asset format");
+  }
+  this->set_split(asset_frames);
+ }
+ amount=static_cast<size_t>(asset_frames)*static_cast<size_t>(asset_height);
+ if (head.rows!=0)
+ {
+  asset_rows=reinterpret_cast<const IMG_Span*>(this->get_asset_view(head.rows,amount*sizeof(IMG_Span)));
+  asset_spans=reinterpret_cast<const IMG_Span*>(this->get_asset_view(head.spans,static_cast<size_t>(head.span_amount)*sizeof(IMG_Span)));
+  if ((asset_rows==NULL)||(asset_spans==NULL)||(head.rows%ASSET_ALIGN!=0)||(head.spans%ASSET_ALIGN!=0))
+  {
+   Halt("Incorrect asset format");
+  }
+  for (index=0;index<amount;++index)
+  {
+   if ((asset_rows[index].start>head.span_amount)||(asset_rows[index].length>head.span_amount-asset_rows[index].start))
+   {
+    Halt("Incorrect asset format");
+   }
+
+  }
+  for (index=0;index<head.span_amount;++index)
+  {
+   if ((asset_spans[index].start>asset_width)||(asset_spans[index].length>asset_width-asset_spans[index].start))
+   {
+    Halt("Incorrect asset format");
+   }
+
+  }
+
+ }
+ if ((head.masks!=0)&&(head.mask_bits==MASK_BITS))
+ {
+  length=((static_cast<size_t>(asset_width)+MASK_BITS-1)/MASK_BITS)*static_cast<size_t>(asset_height);
+  asset_masks=reinterpret_cast<const unsigned long int*>(this->get_asset_view(head.masks,length*static_cast<size_t>(asset_frames)*sizeof(unsigned long int)));
+  if ((asset_masks==NULL)||(head.masks%ASSET_ALIGN!=0))
+  {
+   Halt("Incorrect asset format");
+  }
+
+ }
+ asset_revision=this->get_revision();
+ if (head.kind!=SINGLE_SPRITE) this->set_frames(head.frames);
+ this->set_kind(static_cast<SPRITE_TYPE>(head.kind));
+}
+
+void Sprite::load_asset(const char *name)
+{
+ AST_head head;
+ this->load_from_asset(name,head);
+ this->read_asset(head);
+}
+
+void Sprite::load_asset(Pack_File &pack,const char *name)
+{
+ AST_head head;
+ this->load_from_asset(pack,name,head);
+ this->read_asset(head);
+}
+
+void Sprite::load_sheet(Sprite_Sheet *target)
+{
+ this->release_sheet();
+ sheet=target;
+ sheet_serial=0;
+ sheet_mirror=0;
+ this->set_frames(sheet->get_frames());
+ this->set_frame(1);
+ this->set_kind(sheet->get_kind());
+}
+
+void Sprite::set_transparent(const bool enabled)
+{
+ transparent=enabled;
+}
+
+bool Sprite::get_transparent() const
+{
+ return transparent;
+}
+
+void Sprite::set_x(const unsigned long int x)
+{
+ current_x=x;
+}
+
+void Sprite::set_y(const unsigned long int y)
+{
+ current_y=y;
+}
+
+void Sprite::increase_x()
+{
+ ++current_x;
+}
+
+void Sprite::decrease_x()
+{
+ --current_x;
+}
+
+void Sprite::increase_y()
+{
+ ++current_y;
+}
+
+void Sprite::decrease_y()
+{
+ --current_y;
+}
+
+void Sprite::increase_x(const unsigned long int increment)
+{
+ current_x+=increment;
+}
+
+void Sprite::decrease_x(const unsigned long int decrement)
+{
+ current_x-=decrement;
+}
+
+void Sprite::increase_y(const unsigned long int increment)
+{
+ current_y+=increment;
+}
+
+void Sprite::decrease_y(const unsigned long int decrement)
+{
+ current_y-=decrement;
+}
+
+unsigned long int Sprite::get_x() const
+{
+ return current_x;
+}
+
+unsigned long int Sprite::get_y() const
+{
+ return current_y;
+}
+
+unsigned long int Sprite::get_width() const
+{
+ return sprite_width;
+}
+
+unsigned long int Sprite::get_height() const
+{
+ return sprite_height;
+}
+
+Sprite* Sprite::get_handle()
+{
+ return this;
+}
+
+Collision_Box Sprite::get_box() const
+{
+ Collision_Box target;
+ target.x=current_x;
+ target.y=current_y;
+ target.width=sprite_width;
+ target.height=sprite_height;
+ target.mask=this->get_mask();
+ return target;
+}
+
+const unsigned long int *Sprite::get_mask() const
+{
+ const unsigned long int *target;
+ target=NULL;
+ if ((mirror==0)&&(asset_masks!=NULL)&&(this->check_asset()==true))
+ {
+  target=asset_masks+mask_length*static_cast<size_t>(this->get_mask_frame()-1);
+ }
+ else if ((masks[mirror]!=NULL)&&(mask_revision==this->get_revision()))
+ {
+  if ((mask_width==sprite_width)&&(mask_height==sprite_height)&&(mask_frames>=this->get_mask_frame()))
+  {
+   target=masks[mirror]+mask_length*static_cast<size_t>(this->get_mask_frame()-1);
+  }
+
+ }
+ return target;
+}
+
+void Sprite::mirror_image(const MIRROR_TYPE kind)
+{
+ bool actual;
+ if (sheet!=NULL)
+ {
+  if (kind==MIRROR_HORIZONTAL) sheet_mirror^=1;
+  if (kind==MIRROR_VERTICAL) sheet_mirror^=2;
+  sheet_serial=0;
+  this->load_sheet_frame();
+ }
+ else
+ {
+  actual=(mask_revision==this->get_revision());
+  this->Surface::mirror_image(kind);
+  if (actual==true)
+  {
+   mask_revision=this->get_revision();
+   if (kind==MIRROR_HORIZONTAL) mirror^=1;
+   if (kind==MIRROR_VERTICAL) mirror^=2;
+  }
+
+ }
+ this->prepare_masks();
+}
+
+void Sprite::horizontal_mirror()
+{
+ this->mirror_image(MIRROR_HORIZONTAL);
+}
+
+void Sprite::vertical_mirror()
+{
+ this->mirror_image(MIRROR_VERTICAL);
+}
+
+void Sprite::set_kind(const SPRITE_TYPE kind)
+{
+ if (sheet!=NULL)
+ {
+  this->load_sheet_frame();
+ }
+ else
+ {
+  switch(kind)
+  {
+   case SINGLE_SPRITE:
+   sprite_width=this->get_image_width();
+   sprite_height=this->get_image_height();
+   this->split_frames(1);
+   break;
+   case HORIZONTAL_STRIP:
+   sprite_width=this->get_image_width()/this->get_frames();
+   sprite_height=this->get_image_height();
+   this->split_frames(this->get_frames());
+   break;
+   case VERTICAL_STRIP:
+   sprite_width=this->get_image_width();
+   sprite_height=this->get_image_height()/this->get_frames();
+   this->split_frames(1);
+   break;
+  }
+  current_kind=kind;
+  start=this->get_frame_offset(this->get_frame());
+ }
+ this->prepare_masks();
+}
+
+SPRITE_TYPE Sprite::get_kind() const
+{
+ return current_kind;
+}
+
+void Sprite::set_target(const unsigned long int target)
+{
+ this->set_frame(target);
+ this->set_kind(current_kind);
+}
+
+void Sprite::step()
+{
+ this->increase_frame();
+ this->set_kind(current_kind);
+}
+
+void Sprite::set_position(const unsigned long int x,const unsigned long int y)
+{
+ current_x=x;
+ current_y=y;
+}
+
+void Sprite::clone(Sprite &target)
+{
+ unsigned short int *buffer;
+ if (target.sheet!=NULL)
+ {
+  this->load_sheet(target.sheet);
+  this->set_target(target.get_frame());
+  if ((target.sheet_mirror&1)!=0) this->horizontal_mirror();
+  if ((target.sheet_mirror&2)!=0) this->vertical_mirror();
+  this->set_transparent(target.get_transparent());
+ }
+ else
+ {
+  this->release_sheet();
+  this->clear_buffer();
+  this->set_width(target.get_image_width());
+  this->set_height(target.get_image_height());
+  if (target.check_packed()==true)
+  {
+   buffer=this->create_packed_buffer(target.get_image_width(),target.get_image_height());
+   memmove(buffer,target.get_packed_image(),target.get_length());
+   this->set_packed_buffer(buffer);
+  }
+  else
+  {
+   this->set_buffer(this->create_buffer(target.get_image_width(),target.get_image_height()));
+   memmove(this->get_image(),target.get_image(),target.get_length());
+  }
+  this->set_split(target.get_split());
+  this->set_frames(target.get_frames());
+  this->set_kind(target.get_kind());
+  this->set_transparent(target.get_transparent());
+ }
+
+}
+
+void Sprite::draw_sprite()
+{
+ if (sheet!=NULL) this->set_kind(current_kind);
+ if (transparent==true)
+ {
+  if ((asset_rows!=NULL)&&(this->check_asset()==true))
+  {
+   this->draw_packed_spans();
+  }
+  else
+  {
+   this->draw_transparent_sprite();
+  }
+
+ }
+ else
+ {
+  if (this->check_packed()==true)
+  {
+   this->draw_packed_sprite();
+  }
+  else
+  {
+   this->draw_normal_sprite();
+  }
+
+ }
+
+}
+
+void Sprite::draw_sprite(const unsigned long int x,const unsigned long int y)
+{
+ this->set_position(x,y);
+ this->draw_sprite();
+}
+
+void Sprite::draw_sprite(const bool transparency)
+{
+ this->set_transparent(transparency);
+ this->draw_sprite();
+}
+
+void Sprite::draw_sprite(const bool transparency,const unsigned long int x,const unsigned long int y)
+{
+ this->set_transparent(transparency);
+ this->draw_sprite(x,y);
+}
+
+Asset_Writer::Asset_Writer()
+{
+ memset(&head,0,sizeof(AST_head));
+ sprite_width=0;
+ sprite_height=0;
+ position=0;
+ row_words=0;
+ pixels=NULL;
+ rows=NULL;
+ spans=NULL;
+ masks=NULL;
+}
+
+Asset_Writer::~Asset_Writer()
+{
+ this->clear_asset();
+}
+
+void Asset_Writer::clear_asset()
+{
+ if (pixels!=NULL)
+ {
+  free(pixels);
+  pixels=NULL;
+ }
+ if (rows!=NULL)
+ {
+  free(rows);
+  rows=NULL;
+ }
+ if (spans!=NULL)
+ {
+  free(spans);
+  spans=NULL;
+ }
+ if (masks!=NULL)
+ {
+  free(masks);
+  masks=NULL;
+ }
+
+}
+
+size_t Asset_Writer::get_frame_offset(const unsigned long int frame) const
+{
+ size_t offset;
+ offset=0;
+ switch(head.kind)
+ {
+  case SINGLE_SPRITE:
+  offset=0;
+  break;
+  case HORIZONTAL_STRIP:
+  offset=static_cast<size_t>(frame)*static_cast<size_t>(sprite_width);
+  break;
+  case VERTICAL_STRIP:
+  offset=static_cast<size_t>(frame)*static_cast<size_t>(sprite_width)*static_cast<size_t>(sprite_height);
+  break;
+ }
+ return offset;
+}
+
+bool Asset_Writer::check_opaque(Image &buffer,const size_t offset) const
+{
+ bool result;
+ if (buffer.get_packed()==true)
+ {
+  result=(pixels[offset]!=pixels[0]);
+ }
+ else
+ {
+  result=(memcmp(buffer.get_data()+offset*3,buffer.get_data(),3)!=0);
+ }
+ return result;
+}
+
+void Asset_Writer::create_pixels(Image &buffer)
+{
+ size_t index,amount;
+ const unsigned char *source;
+ amount=static_cast<size_t>(head.width)*static_cast<size_t>(head.height);
+ pixels=static_cast<unsigned short int*>(calloc(amount,sizeof(unsigned short int)));
+ if (pixels==NULL)
+ {
+  Halt("Can't allocate memory for asset");
+ }
+ source=buffer.get_data();
+ if (buffer.get_packed()==true)
+ {
+  memcpy(pixels,source,amount*sizeof(unsigned short int));
+ }
+ else
+ {
+  for (index=0;index<amount;++index)
+  {
+   pixels[index]=pack_pixel(source[index*3+2],source[index*3+1],source[index*3]);
+  }
+
+ }
+ head.key=pixels[0];
+}
+
+void Asset_Writer::split_pixels()
+{
+ unsigned long int frame,y;
+ unsigned short int *target;
+ target=static_cast<unsigned short int*>(calloc(static_cast<size_t>(head.width)*static_cast<size_t>(head.height),sizeof(unsigned short int)));
+ if (target==NULL)
+ {
+  Halt("Can't allocate memory for asset");
+ }
+ for (frame=0;frame<head.frames;++frame)
+ {
+  for (y=0;y<sprite_height;++y)
+  {
+   memcpy(target+(static_cast<size_t>(frame)*static_cast<size_t>(sprite_height)+static_cast<size_t>(y))*static_cast<size_t>(sprite_width),pixels+this->get_frame_offset(frame)+static_cast<size_t>(y)*static_cast<size_t>(head.width),static_cast<size_t>(sprite_width)*sizeof(unsigned short int));
+  }
+
+ }
+ free(pixels);
+ pixels=target;
+ head.flags|=ASSET_SPLIT;
+}
+
+void Asset_Writer::create_spans(Image &buffer)
+{
+ unsigned long int frame,x,y,begin;
+ size_t row,offset,amount;
+ amount=static_cast<size_t>(head.frames)*static_cast<size_t>(sprite_height);
+ rows=static_cast<IMG_Span*>(calloc(amount,sizeof(IMG_Span)));
+ spans=static_cast<IMG_Span*>(calloc(amount*((static_cast<size_t>(sprite_width)+1)/2),sizeof(IMG_Span)));
+ if ((rows==NULL)||(spans==NULL))
+ {
+  Halt("Can't allocate memory for asset");
+ }
+ amount=0;
+ for (frame=0;frame<head.frames;++frame)
+ {
+  for (y=0;y<sprite_height;++y)
+  {
+   row=static_cast<size_t>(frame)*static_cast<size_t>(sprite_height)+static_cast<size_t>(y);
+   offset=this->get_frame_offset(frame)+static_cast<size_t>(y)*static_cast<size_t>(head.width);
+   rows[row].start=amount;
+   x=0;
+   while (x<sprite_width)
+   {
+    if (this->check_opaque(buffer,offset+x)==true)
+    {
+     begin=x;
+     while ((x<sprite_width)&&(this->check_opaque(buffer,offset+x)==true))
+     {
+      ++x;
+     }
+     spans[amount].start=begin;
+     spans[amount].length=x-begin;
+     ++amount;
+    }
+    else
+    {
+     ++x;
+    }
+
+   }
+   rows[row].length=amount-rows[row].start;
+  }
+
+ }
+ head.span_amount=amount;
+}
+
+void Asset_Writer::create_masks(Image &buffer)
+{
+ unsigned long int frame,x,y;
+ size_t length,offset,target;
+ row_words=(static_cast<size_t>(sprite_width)+ASSET_MASK_BITS-1)/ASSET_MASK_BITS;
+ length=row_words*(ASSET_MASK_BITS/CHAR_BIT)*static_cast<size_t>(sprite_height);
+ masks=static_cast<unsigned char*>(calloc(length*static_cast<size_t>(head.frames),sizeof(unsigned char)));
+ if (masks==NULL)
+ {
+  Halt("Can't allocate memory for asset");
+ }
+ for (frame=0;frame<head.frames;++frame)
+ {
+  for (y=0;y<sprite_height;++y)
+  {
+   offset=this->get_frame_offset(frame)+static_cast<size_t>(y)*static_cast<size_t>(head.width);
+   for (x=0;x<sprite_width;++x)
+   {
+    if (this->check_opaque(buffer,offset+x)==true)
+    {
+     target=length*static_cast<size_t>(frame)+row_words*(ASSET_MASK_BITS/CHAR_BIT)*static_cast<size_t>(y)+x/CHAR_BIT;
+     masks[target]|=static_cast<unsigned char>(1<<(x%CHAR_BIT));
+    }
+
+   }
+
+  }
+
+ }
+
+}
+
+unsigned long int Asset_Writer::write_section(void *data,const size_t length)
+{
+ unsigned char padding[ASSET_ALIGN];
+ unsigned long int offset;
+ memset(padding,0,ASSET_ALIGN);
+ if (position%ASSET_ALIGN!=0)
+ {
+  target.write(padding,ASSET_ALIGN-position%ASSET_ALIGN);
+  position+=ASSET_ALIGN-position%ASSET_ALIGN;
+ }
+ offset=position;
+ target.write(data,length);
+ position+=length;
+ return offset;
+}
+
+void Asset_Writer::write_asset(const char *name,Image &buffer,const SPRITE_TYPE kind,const unsigned long int frames)
+{
+ size_t amount;
+ if ((buffer.get_data()==NULL)||(frames==0))
+ {
+  Halt("Incorrect asset format");
+ }
+ this->clear_asset();
+ memset(&head,0,sizeof(AST_head));
+ memcpy(head.signature,"DAST",4);
+ head.width=buffer.get_width();
+ head.height=buffer.get_height();
+ head.frames=1;
+ head.format=ASSET_RGB565;
+ head.kind=kind;
+ head.mask_bits=ASSET_MASK_BITS;
+ if (kind!=SINGLE_SPRITE) head.frames=frames;
+ sprite_width=head.width;
+ sprite_height=head.height;
+ if (kind==HORIZONTAL_STRIP) sprite_width/=head.frames;
+ if (kind==VERTICAL_STRIP) sprite_height/=head.frames;
+ if ((sprite_width==0)||(sprite_height==0))
+ {
+  Halt("Incorrect asset format");
+ }
+ this->create_pixels(buffer);
+ this->create_spans(buffer);
+ this->create_masks(buffer);
+ if ((head.kind==HORIZONTAL_STRIP)&&(head.frames>1)&&(head.width%head.frames==0)) this->split_pixels();
+ amount=static_cast<size_t>(head.frames)*static_cast<size_t>(sprite_height);
+ target.open(name);
+ target.write(&head,ASSET_HEAD_LENGTH);
+ position=ASSET_HEAD_LENGTH;
+ head.pixels=this->write_section(pixels,static_cast<size_t>(head.width)*static_cast<size_t>(head.height)*sizeof(unsigned short int));
+ head.rows=this->write_section(rows,amount*sizeof(IMG_Span));
+ head.spans=this->write_section(spans,static_cast<size_t>(head.span_amount)*sizeof(IMG_Span));
+ head.masks=this->write_section(masks,row_words*(ASSET_MASK_BITS/CHAR_BIT)*amount);
+ target.set_position(0);
+ target.write(&head,ASSET_HEAD_LENGTH);
+ target.close();
+ this->clear_asset();
+}
+
+template <unsigned long int SIZE>
+void draw_tile_block(unsigned short int *target,const unsigned short int *source,const size_t pitch)
+{
+ unsigned long int y;
+ for (y=0;y<SIZE;++y)
+ {
+  memcpy(target,source,SIZE*sizeof(unsigned short int));
+  target+=pitch;
+  source+=SIZE;
+ }
+
+}
+
+template <unsigned long int SIZE>
+void draw_transparent_tile_block(unsigned short int *target,const unsigned short int *source,const unsigned long int *mask,const size_t pitch)
+{
+ unsigned long int x,y,bits;
+ const unsigned long int full=ULONG_MAX>>(MASK_BITS-SIZE);
+ for (y=0;y<SIZE;++y)
+ {
+  bits=mask[y];
+  if (bits==full)
+  {
+   memcpy(target,source,SIZE*sizeof(unsigned short int));
+  }
+  else
+  {
+   for (x=0;bits!=0;++x)
+   {
+    if ((bits&1)!=0) target[x]=source[x];
+    bits>>=1;
+   }
+
+  }
+  target+=pitch;
+  source+=SIZE;
+ }
+
+}
+
+Tileset::Tileset()
+{
+ selected=0;
+ transparent=false;
+ rows=0;
+ columns=0;
+ tile_width=0;
+ tile_height=0;
+ mask_width=0;
+ tiles_revision=0;
+ tile_pixels=NULL;
+ tile_masks=NULL;
+ animations=NULL;
+ animation_amount=0;
+ animation_index=NULL;
+ animation_time=0;
+ animation_start=0;
+ animation_tick=0;
+ animation_change=0;
+ animation_revision=0;
+ animation_clock=false;
+}
+
+Tileset::~Tileset()
+{
+ this->clear_animations();
+ this->clear_tiles();
+}
+
+void Tileset::clear_tiles()
+{
+ if (tile_pixels!=NULL)
+ {
+  free(tile_pixels);
+  tile_pixels=NULL;
+ }
+ if (tile_masks!=NULL)
+ {
+  free(tile_masks);
+  tile_masks=NULL;
+ }
+
+}
+
+void Tileset::create_tiles()
+{
+ unsigned long int row,column,x,y;
+ size_t source,position,amount;
+ IMG_Pixel *image;
+ unsigned short int *target;
+ unsigned long int *mask;
+ image=this->get_image();
+ amount=static_cast<size_t>(rows)*static_cast<size_t>(columns);
+ mask_width=(tile_width+MASK_BITS-1)/MASK_BITS;
+ tile_pixels=static_cast<unsigned short int*>(calloc(amount*static_cast<size_t>(tile_width)*static_cast<size_t>(tile_height),sizeof(unsigned short int)));
+ tile_masks=static_cast<unsigned long int*>(calloc(amount*static_cast<size_t>(mask_width)*static_cast<size_t>(tile_height),sizeof(unsigned long int)));
+ if ((tile_pixels==NULL)||(tile_masks==NULL))
+ {
+  Halt("Can't allocate memory for tile buffer");
+ }
+ target=tile_pixels;
+ mask=tile_masks;
+ for (column=0;column<columns;++column)
+ {
+  for (row=0;row<rows;++row)
+  {
+   for (y=0;y<tile_height;++y)
+   {
+    source=this->get_offset(0,row*tile_width,column*tile_height+y);
+    for (x=0;x<tile_width;++x)
+    {
+     position=source+static_cast<size_t>(x);
+     target[x]=pack_pixel(image[position].red,image[position].green,image[position].blue);
+     if (this->compare_pixels(0,position)==true) mask[x/MASK_BITS]|=1UL<<(x%MASK_BITS);
+    }
+    target+=tile_width;
+    mask+=mask_width;
+   }
+
+  }
+
+ }
+
+}
+
+void Tileset::prepare_tiles()
+{
+ if (tiles_revision!=this->get_revision())
+ {
+  this->clear_tiles();
+  if ((this->get_image()!=NULL)&&(tile_width>0)&&(tile_height>0))
+  {
+   this->create_tiles();
+  }
+  tiles_revision=this->get_revision();
+ }
+
+}
+
+void Tileset::draw_tile_rows(unsigned short int *target,const size_t pitch,const unsigned long int width,const unsigned long int height)
+{
+ unsigned long int y;
+ const unsigned short int *source;
+ source=tile_pixels+selected*static_cast<size_t>(tile_width)*static_cast<size_t>(tile_height);
+ for (y=0;y<height;++y)
+ {
+  memcpy(target,source,static_cast<size_t>(width)*sizeof(unsigned short int));
+  target+=pitch;
+  source+=tile_width;
+ }
+
+}
+
+void Tileset::draw_transparent_rows(unsigned short int *target,const size_t pitch,const unsigned long int width,const unsigned long int height)
+{
+ unsigned long int x,y;
+ const unsigned short int *source;
+ const unsigned long int *mask;
+ source=tile_pixels+selected*static_cast<size_t>(tile_width)*static_cast<size_t>(tile_height);
+ mask=tile_masks+selected*static_cast<size_t>(mask_width)*static_cast<size_t>(tile_height);
+ for (y=0;y<height;++y)
+ {
+  for (x=0;x<width;++x)
+  {
+   if (((mask[x/MASK_BITS]>>(x%MASK_BITS))&1)!=0) target[x]=source[x];
+  }
+  target+=pitch;
+  source+=tile_width;
+  mask+=mask_width;
+ }
+
+}
+
+void Tileset::clear_animation(TILE_Animation &target)
+{
+ if (target.sequence!=NULL)
+ {
+  free(target.sequence);
+  target.sequence=NULL;
+ }
+ if (target.durations!=NULL)
+ {
+  free(target.durations);
+  target.durations=NULL;
+ }
+ target.amount=0;
+ target.period=0;
+}
+
+TILE_Animation &Tileset::get_animation_slot(const unsigned short int tile)
+{
+ size_t length;
+ TILE_Animation *target;
+ if (animation_index==NULL)
+ {
+  length=static_cast<size_t>(rows)*static_cast<size_t>(columns);
+  animation_index=static_cast<unsigned short int*>(calloc(length,sizeof(unsigned short int)));
+  if (animation_index==NULL)
+  {
+   Halt("Can't allocate memory for tile animation index");
+  }
+
+ }
+ if (animation_index[tile]==0)
+ {
+  target=static_cast<TILE_Animation*>(realloc(animations,(animation_amount+1)*sizeof(TILE_Animation)));
+  if (target==NULL)
+  {
+   Halt("Can't allocate memory for tile animation");
+  }
+  animations=target;
+  animations[animation_amount].sequence=NULL;
+  animations[animation_amount].durations=NULL;
+  animations[animation_amount].amount=0;
+  animations[animation_amount].period=0;
+  ++animation_amount;
+  animation_index[tile]=animation_amount;
+ }
+ return animations[animation_index[tile]-1];
+}
+
+unsigned long int Tileset::get_tile_width() const
+{
+ return tile_width;
+}
+
+unsigned long int Tileset::get_tile_height() const
+{
+ return tile_height;
+}
+
+unsigned long int Tileset::get_rows() const
+{
+ return rows;
+}
+
+unsigned long int Tileset::get_columns() const
+{
+ return columns;
+}
+
+void Tileset::set_transparent(const bool enabled)
+{
+ transparent=enabled;
+}
+
+bool Tileset::get_transparent() const
+{
+ return transparent;
+}
+
+void Tileset::select_tile(const unsigned long int row,const unsigned long int column)
+{
+ if ((row<rows)&&(column<columns))
+ {
+  selected=static_cast<size_t>(column)*static_cast<size_t>(rows)+static_cast<size_t>(row);
+ }
+
+}
+
+void Tileset::draw_tile(const unsigned long int x,const unsigned long int y)
+{
+ unsigned long int width,height,kernel,screen_width,screen_height;
+ unsigned short int *target;
+ const unsigned short int *source;
+ const unsigned long int *mask;
+ this->prepare_tiles();
+ screen_width=this->get_surface_width();
+ screen_height=this->get_surface_height();
+ if ((tile_pixels!=NULL)&&(x<screen_width)&&(y<screen_height))
+ {
+  width=tile_width;
+  height=tile_height;
+  if (width>screen_width-x) width=screen_width-x;
+  if (height>screen_height-y) height=screen_height-y;
+  kernel=0;
+  if ((width==tile_width)&&(height==tile_height)&&(tile_width==tile_height)) kernel=tile_width;
+  target=this->get_surface_buffer()+this->get_offset(0,x,y,screen_width);
+  source=tile_pixels+selected*static_cast<size_t>(tile_width)*static_cast<size_t>(tile_height);
+  mask=tile_masks+selected*static_cast<size_t>(mask_width)*static_cast<size_t>(tile_height);
+  if (transparent==true)
+  {
+   switch (kernel)
+   {
+    case 8:
+    draw_transparent_tile_block<8>(target,source,mask,screen_width);
+    break;
+    case 16:
+    draw_transparent_tile_block<16>(target,source,mask,screen_width);
+    break;
+    case 32:
+    draw_transparent_tile_block<32>(target,source,mask,screen_width);
+    break;
+    default:
+    this->draw_transparent_rows(target,screen_width,width,height);
+    break;
+   }
+
+  }
+  else
+  {
+   switch (kernel)
+   {
+    case 8:
+    draw_tile_block<8>(target,source,screen_width);
+    break;
+    case 16:
+    draw_tile_block<16>(target,source,screen_width);
+    break;
+    case 32:
+    draw_tile_block<32>(target,source,screen_width);
+    break;
+    default:
+    this->draw_tile_rows(target,screen_width,width,height);
+    break;
+   }
+
+  }
+
+ }
+
+}
+
+void Tileset::draw_tile(const unsigned long int row,const unsigned long int column,const unsigned long int x,const unsigned long int y)
+{
+ this->select_tile(row,column);
+ this->draw_tile(x,y);
+}
+
+void Tileset::copy_tile(unsigned short int *target,const unsigned long int target_width)
+{
+ unsigned long int kernel;
+ const unsigned short int *source;
+ this->prepare_tiles();
+ if (tile_pixels!=NULL)
+ {
+  kernel=0;
+  if (tile_width==tile_height) kernel=tile_width;
+  source=tile_pixels+selected*static_cast<size_t>(tile_width)*static_cast<size_t>(tile_height);
+  switch (kernel)
+  {
+   case 8:
+   draw_tile_block<8>(target,source,target_width);
+   break;
+   case 16:
+   draw_tile_block<16>(target,source,target_width);
+   break;
+   case 32:
+   draw_tile_block<32>(target,source,target_width);
+   break;
+   default:
+   this->draw_tile_rows(target,target_width,tile_width,tile_height);
+   break;
+  }
+
+ }
+
+}
+
+void Tileset::load_tileset(Image &buffer,const unsigned long int row_amount,const unsigned long int column_amount)
+{
+ if ((row_amount>0)&&(column_amount>0))
+ {
+  this->load_from_buffer(buffer);
+  rows=row_amount;
+  columns=column_amount;
+  tile_width=this->get_image_width()/rows;
+  tile_height=this->get_image_height()/columns;
+  this->clear_animations();
+ }
+
+}
+
+void Tileset::add_animation(const unsigned long int row,const unsigned long int column,const TILE_Frame *frames,const size_t amount)
+{
+ size_t index;
+ unsigned long int period;
+ if ((row<rows)&&(column<columns)&&(frames!=NULL)&&(amount>0))
+ {
+  period=0;
+  for (index=0;index<amount;++index)
+  {
+   if ((frames[index].row>=rows)||(frames[index].column>=columns)) return;
+   period+=frames[index].duration;
+  }
+  TILE_Animation &target=this->get_animation_slot(column*rows+row);
+  this->clear_animation(target);
+  target.sequence=static_cast<unsigned short int*>(calloc(amount,sizeof(unsigned short int)));
+  target.durations=static_cast<unsigned long int*>(calloc(amount,sizeof(unsigned long int)));
+  if ((target.sequence==NULL)||(target.durations==NULL))
+  {
+   Halt("Can't allocate memory for tile animation");
+  }
+  for (index=0;index<amount;++index)
+  {
+   target.sequence[index]=frames[index].column*rows+frames[index].row;
+   target.durations[index]=frames[index].duration;
+  }
+  target.amount=amount;
+  target.period=period;
+  target.tile=target.sequence[0];
+  target.stamp=animation_tick;
+  ++animation_revision;
+  this->set_animation_time(animation_time);
+ }
+
+}
+
+void Tileset::clear_animations()
+{
+ size_t index;
+ if (animations!=NULL)
+ {
+  for (index=0;index<animation_amount;++index)
+  {
+   this->clear_animation(animations[index]);
+  }
+  free(animations);
+  animations=NULL;
+  ++animation_revision;
+ }
+ if (animation_index!=NULL)
+ {
+  free(animation_index);
+  animation_index=NULL;
+ }
+ animation_amount=0;
+}
+
+size_t Tileset::get_animations() const
+{
+ return animation_amount;
+}
+
+void Tileset::update_animation()
+{
+ struct timeval now;
+ unsigned long int milliseconds;
+ gettimeofday(&now,NULL);
+ milliseconds=static_cast<unsigned long int>(now.tv_sec)*1000+static_cast<unsigned long int>(now.tv_usec)/1000;
+ if (animation_clock==false)
+ {
+  animation_start=milliseconds-animation_time;
+  animation_clock=true;
+ }
+ this->set_animation_time(milliseconds-animation_start);
+}
+
+void Tileset::set_animation_time(const unsigned long int milliseconds)
+{
+ size_t index,frame;
+ unsigned long int position;
+ animation_time=milliseconds;
+ ++animation_tick;
+ for (index=0;index<animation_amount;++index)
+ {
+  TILE_Animation &target=animations[index];
+  if (target.period>0)
+  {
+   position=animation_time%target.period;
+   for (frame=0;position>=target.durations[frame];++frame)
+   {
+    position-=target.durations[frame];
+   }
+   if (target.tile!=target.sequence[frame])
+   {
+    target.tile=target.sequence[frame];
+    target.stamp=animation_tick;
+    animation_change=animation_tick;
+   }
+
+  }
+
+ }
+
+}
+
+unsigned long int Tileset::get_animation_time() const
+{
+ return animation_time;
+}
+
+unsigned long int Tileset::get_animation_tick() const
+{
+ return animation_tick;
+}
+
+unsigned long int Tileset::get_animation_change() const
+{
+ return animation_change;
+}
+
+unsigned long int Tileset::get_animation_revision() const
+{
+ return animation_revision;
+}
+
+bool Tileset::check_animated(const unsigned short int tile) const
+{
+ bool animated;
+ animated=false;
+ if (animation_index!=NULL)
+ {
+  if (tile<rows*columns) animated=animation_index[tile]!=0;
+ }
+ return animated;
+}
+
+unsigned short int Tileset::get_animated_tile(const unsigned short int tile) const
+{
+ unsigned short int result;
+ result=tile;
+ if (this->check_animated(tile)==true)
+ {
+  result=animations[animation_index[tile]-1].tile;
+ }
+ return result;
+}
+
+unsigned long int Tileset::get_animation_stamp(const unsigned short int tile) const
+{
+ unsigned long int stamp;
+ stamp=0;
+ if (this->check_animated(tile)==true)
+ {
+  stamp=animations[animation_index[tile]-1].stamp;
+ }
+ return stamp;
+}
+
+void Tileset::select_animated_tile(const unsigned long int row,const unsigned long int column)
+{
+ unsigned short int tile;
+ if ((row<rows)&&(column<columns))
+ {
+  tile=this->get_animated_tile(column*rows+row);
+  this->select_tile(tile%rows,tile/rows);
+ }
+
+}
+
+Tileset* Tileset::get_handle()
+{
+ return this;
+}
+
+Tilemap::Tilemap()
+{
+ surface=NULL;
+ tileset=NULL;
+ tiles=NULL;
+ dirty=NULL;
+ chunks=NULL;
+ animated=NULL;
+ animated_amount=0;
+ animated_ready=false;
+ animation_tick=0;
+ animation_revision=0;
+ resident=0;
+ chunk_limit=TILEMAP_CHUNKS;
+ map_width=0;
+ map_height=0;
+ chunk_width=0;
+ chunk_height=0;
+ chunk_columns=0;
+ chunk_rows=0;
+ camera_x=0;
+ camera_y=0;
+ stamp=0;
+}
+
+Tilemap::~Tilemap()
+{
+ this->clear_tilemap();
+}
+
+void Tilemap::clear_chunks()
+{
+ size_t index,amount;
+ if (chunks!=NULL)
+ {
+  amount=static_cast<size_t>(chunk_columns)*static_cast<size_t>(chunk_rows);
+  for (index=0;index<amount;++index)
+  {
+   if (chunks[index].pixels!=NULL) free(chunks[index].pixels);
+  }
+  free(chunks);
+  chunks=NULL;
+ }
+ resident=0;
+}
+
+void Tilemap::clear_animated()
+{
+ if (animated!=NULL)
+ {
+  free(animated);
+  animated=NULL;
+ }
+ animated_amount=0;
+ animated_ready=false;
+}
+
+void Tilemap::clear_tilemap()
+{
+ this->clear_chunks();
+ this->clear_animated();
+ if (tiles!=NULL)
+ {
+  free(tiles);
+  tiles=NULL;
+ }
+ if (dirty!=NULL)
+ {
+  free(dirty);
+  dirty=NULL;
+ }
+
+}
+
+void Tilemap::create_chunks()
+{
+ size_t index,amount;
+ chunk_width=surface->get_frame_width()+tileset->get_tile_width()-1;
+ chunk_width-=chunk_width%tileset->get_tile_width();
+ chunk_height=surface->get_frame_height()+tileset->get_tile_height()-1;
+ chunk_height-=chunk_height%tileset->get_tile_height();
+ chunk_columns=(map_width*tileset->get_tile_width()+chunk_width-1)/chunk_width;
+ chunk_rows=(map_height*tileset->get_tile_height()+chunk_height-1)/chunk_height;
+ amount=static_cast<size_t>(chunk_columns)*static_cast<size_t>(chunk_rows);
+ chunks=static_cast<MAP_Chunk*>(calloc(amount,sizeof(MAP_Chunk)));
+ if (chunks==NULL)
+ {
+  Halt("Can't allocate memory for tilemap chunks");
+ }
+ for (index=0;index<amount;++index)
+ {
+  chunks[index].pixels=NULL;
+  chunks[index].stamp=0;
+  chunks[index].dirty=false;
+ }
+ resident=0;
+}
+
+unsigned short int *Tilemap::get_chunk_memory()
+{
+ size_t index,amount,oldest;
+ unsigned short int *target;
+ target=NULL;
+ if ((resident<chunk_limit)||(resident==0))
+ {
+  target=static_cast<unsigned short int*>(calloc(static_cast<size_t>(chunk_width)*static_cast<size_t>(chunk_height),sizeof(unsigned short int)));
+  if (target==NULL)
+  {
+   Halt("Can't allocate memory for tilemap chunk");
+  }
+  ++resident;
+ }
+ else
+ {
+  amount=static_cast<size_t>(chunk_columns)*static_cast<size_t>(chunk_rows);
+  oldest=amount;
+  for (index=0;index<amount;++index)
+  {
+   if (chunks[index].pixels!=NULL)
+   {
+    if ((oldest==amount)||(chunks[index].stamp<chunks[oldest].stamp)) oldest=index;
+   }
+
+  }
+  target=chunks[oldest].pixels;
+  chunks[oldest].pixels=NULL;
+  chunks[oldest].dirty=false;
+ }
+ return target;
+}
+
+void Tilemap::mark_tile(const unsigned long int x,const unsigned long int y)
+{
+ dirty[static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(map_width)]=1;
+ if (chunks!=NULL)
+ {
+  chunks[static_cast<size_t>((x*tileset->get_tile_width())/chunk_width)+static_cast<size_t>((y*tileset->get_tile_height())/chunk_height)*static_cast<size_t>(chunk_columns)].dirty=true;
+ }
+
+}
+
+void Tilemap::create_animated()
+{
+ size_t index,length;
+ this->clear_animated();
+ length=static_cast<size_t>(map_width)*static_cast<size_t>(map_height);
+ for (index=0;index<length;++index)
+ {
+  if (tileset->check_animated(tiles[index])==true) ++animated_amount;
+ }
+ if (animated_amount>0)
+ {
+  animated=static_cast<size_t*>(calloc(animated_amount,sizeof(size_t)));
+  if (animated==NULL)
+  {
+   Halt("Can't allocate memory for animated tiles");
+  }
+  animated_amount=0;
+  for (index=0;index<length;++index)
+  {
+   if (tileset->check_animated(tiles[index])==true)
+   {
+    animated[animated_amount]=index;
+    ++animated_amount;
+   }
+
+  }
+
+ }
+ animated_ready=true;
+}
+
+void Tilemap::update_animated()
+{
+ size_t index;
+ unsigned long int x,y;
+ MAP_Chunk *target;
+ if (animation_revision!=tileset->get_animation_revision())
+ {
+  animation_revision=tileset->get_animation_revision();
+  this->invalidate();
+ }
+ if (animated_ready==false) this->create_animated();
+ if ((chunks!=NULL)&&(tileset->get_animation_change()!=animation_tick))
+ {
+  for (index=0;index<animated_amount;++index)
+  {
+   if (tileset->get_animation_stamp(tiles[animated[index]])>animation_tick)
+   {
+    x=animated[index]%map_width;
+    y=animated[index]/map_width;
+    target=chunks+static_cast<size_t>((x*tileset->get_tile_width())/chunk_width)+static_cast<size_t>((y*tileset->get_tile_height())/chunk_height)*static_cast<size_t>(chunk_columns);
+    if (target->pixels!=NULL) this->mark_tile(x,y);
+   }
+
+  }
+  animation_tick=tileset->get_animation_change();
+ }
+
+}
+
+void Tilemap::render_tile(MAP_Chunk &target,const unsigned long int x,const unsigned long int y)
+{
+ unsigned long int tile_width,tile_height,index;
+ size_t position;
+ tile_width=tileset->get_tile_width();
+ tile_height=tileset->get_tile_height();
+ index=tiles[static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(map_width)];
+ position=static_cast<size_t>((x*tile_width)%chunk_width)+static_cast<size_t>((y*tile_height)%chunk_height)*static_cast<size_t>(chunk_width);
+ index=tileset->get_animated_tile(index);
+ tileset->select_tile(index%tileset->get_rows(),index/tileset->get_rows());
+ tileset->copy_tile(target.pixels+position,chunk_width);
+}
+
+void Tilemap::render_chunk(MAP_Chunk &target,const unsigned long int chunk_x,const unsigned long int chunk_y,const bool full)
+{
+ unsigned long int x,y,start_x,start_y,stop_x,stop_y;
+ size_t position;
+ start_x=(chunk_x*chunk_width)/tileset->get_tile_width();
+ start_y=(chunk_y*chunk_height)/tileset->get_tile_height();
+ stop_x=start_x+chunk_width/tileset->get_tile_width();
+ stop_y=start_y+chunk_height/tileset->get_tile_height();
+ if (stop_x>map_width) stop_x=map_width;
+ if (stop_y>map_height) stop_y=map_height;
+ for (y=start_y;y<stop_y;++y)
+ {
+  for (x=start_x;x<stop_x;++x)
+  {
+   position=static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(map_width);
+   if ((full==true)||(dirty[position]!=0))
+   {
+    this->render_tile(target,x,y);
+    dirty[position]=0;
+   }
+
+  }
+
+ }
+ target.dirty=false;
+}
+
+MAP_Chunk &Tilemap::prepare_chunk(const unsigned long int chunk_x,const unsigned long int chunk_y)
+{
+ MAP_Chunk &target=chunks[static_cast<size_t>(chunk_x)+static_cast<size_t>(chunk_y)*static_cast<size_t>(chunk_columns)];
+ if (target.pixels==NULL)
+ {
+  target.pixels=this->get_chunk_memory();
+  this->render_chunk(target,chunk_x,chunk_y,true);
+ }
+ if (target.dirty==true)
+ {
+  this->render_chunk(target,chunk_x,chunk_y,false);
+ }
+ ++stamp;
+ target.stamp=stamp;
+ return target;
+}
+
+void Tilemap::draw_chunk(const unsigned long int chunk_x,const unsigned long int chunk_y,const unsigned long int stop_x,const unsigned long int stop_y)
+{
+ unsigned long int left,top,right,bottom,y,frame_width;
+ unsigned short int *target;
+ const unsigned short int *source;
+ left=chunk_x*chunk_width;
+ top=chunk_y*chunk_height;
+ right=left+chunk_width;
+ bottom=top+chunk_height;
+ if (left<camera_x) left=camera_x;
+ if (top<camera_y) top=camera_y;
+ if (right>stop_x) right=stop_x;
+ if (bottom>stop_y) bottom=stop_y;
+ if ((left<right)&&(top<bottom))
+ {
+  frame_width=surface->get_frame_width();
+  source=this->prepare_chunk(chunk_x,chunk_y).pixels+static_cast<size_t>(left-chunk_x*chunk_width)+static_cast<size_t>(top-chunk_y*chunk_height)*static_cast<size_t>(chunk_width);
+  target=surface->get_buffer()+static_cast<size_t>(left-camera_x)+static_cast<size_t>(top-camera_y)*static_cast<size_t>(frame_width);
+  for (y=top;y<bottom;++y)
+  {
+   memcpy(target,source,static_cast<size_t>(right-left)*sizeof(unsigned short int));
+   target+=frame_width;
+   source+=chunk_width;
+  }
+
+ }
+
+}
+
+void Tilemap::initialize(Screen *screen)
+{
+ surface=screen;
+}
+
+void Tilemap::load_tilemap(Tileset *target,const unsigned long int width,const unsigned long int height)
+{
+ size_t length;
+ this->clear_tilemap();
+ tileset=target;
+ map_width=width;
+ map_height=height;
+ length=static_cast<size_t>(width)*static_cast<size_t>(height);
+ if (length>0)
+ {
+  tiles=static_cast<unsigned short int*>(calloc(length,sizeof(unsigned short int)));
+  dirty=static_cast<unsigned char*>(calloc(length,sizeof(unsigned char)));
+  if ((tiles==NULL)||(dirty==NULL))
+  {
+   Halt("Can't allocate memory for tilemap");
+  }
+
+ }
+
+}
+
+unsigned long int Tilemap::get_width() const
+{
+ return map_width;
+}
+
+unsigned long int Tilemap::get_height() const
+{
+ return map_height;
+}
+
+void Tilemap::set_tile(const unsigned long int x,const unsigned long int y,const unsigned long int row,const unsigned long int column)
+{
+ size_t position;
+ unsigned short int index;
+ if ((x<map_width)&&(y<map_height))
+ {
+  position=static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(map_width);
+  index=column*tileset->get_rows()+row;
+  if (tiles[position]!=index)
+  {
+   if ((tileset->check_animated(tiles[position])==true)||(tileset->check_animated(index)==true)) animated_ready=false;
+   tiles[position]=index;
+   this->mark_tile(x,y);
+  }
+
+ }
+
+}
+
+unsigned long int Tilemap::get_tile_row(const unsigned long int x,const unsigned long int y) const
+{
+ unsigned long int row;
+ row=0;
+ if ((x<map_width)&&(y<map_height))
+ {
+  row=tiles[static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(map_width)]%tileset->get_rows();
+ }
+ return row;
+}
+
+unsigned long int Tilemap::get_tile_column(const unsigned long int x,const unsigned long int y) const
+{
+ unsigned long int column;
+ column=0;
+ if ((x<map_width)&&(y<map_height))
+ {
+  column=tiles[static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(map_width)]/tileset->get_rows();
+ }
+ return column;
+}
+
+void Tilemap::set_chunk_limit(const size_t limit)
+{
+ this->clear_chunks();
+ chunk_limit=limit;
+}
+
+size_t Tilemap::get_chunk_limit() const
+{
+ return chunk_limit;
+}
+
+size_t Tilemap::get_resident() const
+{
+ return resident;
+}
+
+size_t Tilemap::get_animated()
+{
+ if ((animated_ready==false)&&(tiles!=NULL)&&(tileset!=NULL)) this->create_animated();
+ return animated_amount;
+}
+
+void Tilemap::set_camera(const unsigned long int x,const unsigned long int y)
+{
+ camera_x=x;
+ camera_y=y;
+}
+
+unsigned long int Tilemap::get_camera_x() const
+{
+ return camera_x;
+}
+
+unsigned long int Tilemap::get_camera_y() const
+{
+ return camera_y;
+}
+
+void Tilemap::invalidate()
+{
+ this->clear_chunks();
+ animated_ready=false;
+}
+
+void Tilemap::draw_tilemap()
+{
+ unsigned long int chunk_x,chunk_y,stop_x,stop_y;
+ if ((tiles!=NULL)&&(tileset!=NULL))
+ {
+  this->update_animated();
+  if (chunks==NULL) this->create_chunks();
+  stop_x=map_width*tileset->get_tile_width();
+  stop_y=map_height*tileset->get_tile_height();
+  if (stop_x>camera_x+surface->get_frame_width()) stop_x=camera_x+surface->get_frame_width();
+  if (stop_y>camera_y+surface->get_frame_height()) stop_y=camera_y+surface->get_frame_height();
+  for (chunk_y=camera_y/chunk_height;chunk_y<chunk_rows;++chunk_y)
+  {
+   if (chunk_y*chunk_height>=stop_y) break;
+   for (chunk_x=camera_x/chunk_width;chunk_x<chunk_columns;++chunk_x)
+   {
+    if (chunk_x*chunk_width>=stop_x) break;
+    this->draw_chunk(chunk_x,chunk_y,stop_x,stop_y);
+   }
+
+  }
+
+ }
+
+}
+
+Tilemap* Tilemap::get_handle()
+{
+ return this;
+}
+
+Map_Stream::Map_Stream()
+{
+ device=-1;
+ run=false;
+ stream=0;
+ pthread_mutex_init(&lock,NULL);
+ pthread_cond_init(&signal,NULL);
+ memset(&head,0,sizeof(MAP_head));
+ index=NULL;
+ slots=NULL;
+ chunk_slots=NULL;
+ slot_amount=0;
+ chunk_limit=TILEMAP_CHUNKS;
+ tile_length=0;
+ collision_length=0;
+ chunk_columns=0;
+ chunk_rows=0;
+ focus_x=0;
+ focus_y=0;
+ margin=1;
+ stamp=0;
+ missed=0;
+}
+
+Map_Stream::~Map_Stream()
+{
+ this->close();
+ pthread_cond_destroy(&signal);
+ pthread_mutex_destroy(&lock);
+}
+
+void Map_Stream::open_device(const char *name)
+{
+ device=::open(name,O_RDONLY);
+ if (device==-1)
+ {
+  Halt("Can't open the map file");
+ }
+
+}
+
+void Map_Stream::read_device(void *buffer,const size_t length,const size_t offset)
+{
+ if (pread(device,buffer,length,static_cast<off_t>(offset))!=static_cast<ssize_t>(length))
+ {
+  Halt("Can't read the map file");
+ }
+
+}
+
+void Map_Stream::read_head()
+{
+ this->read_device(&head,MAP_HEAD_LENGTH,0);
+ if (strncmp(head.signature,"DMAP",4)!=0)
+ {
+  Halt("Incorrect map signature");
+ }
+ if ((head.chunk_width==0)||(head.chunk_height==0)||(head.layers==0))
+ {
+  Halt("Incorrect map format");
+ }
+ chunk_columns=(head.width+head.chunk_width-1)/head.chunk_width;
+ chunk_rows=(head.height+head.chunk_height-1)/head.chunk_height;
+ tile_length=static_cast<size_t>(head.chunk_width)*static_cast<size_t>(head.chunk_height);
+ collision_length=(tile_length+CHAR_BIT-1)/CHAR_BIT;
+}
+
+void Map_Stream::read_index()
+{
+ size_t chunk,amount;
+ amount=static_cast<size_t>(chunk_columns)*static_cast<size_t>(chunk_rows);
+ index=static_cast<MAP_Entry*>(calloc(amount+1,sizeof(MAP_Entry)));
+ chunk_slots=static_cast<size_t*>(calloc(amount+1,sizeof(size_t)));
+ if ((index==NULL)||(chunk_slots==NULL))
+ {
+  Halt("Can't allocate memory for map index");
+ }
+ this->read_device(index,amount*MAP_ENTRY_LENGTH,MAP_HEAD_LENGTH);
+ for (chunk=0;chunk<amount;++chunk)
+ {
+  if ((index[chunk].length!=0)&&(index[chunk].length!=tile_length*head.layers*sizeof(unsigned short int)+collision_length))
+  {
+   Halt("Incorrect map chunk");
+  }
+  chunk_slots[chunk]=MAP_NONE;
+ }
+
+}
+
+void Map_Stream::create_slots()
+{
+ size_t slot;
+ slot_amount=chunk_limit;
+ if (slot_amount==0) slot_amount=1;
+ slots=static_cast<MAP_Slot*>(calloc(slot_amount,sizeof(MAP_Slot)));
+ if (slots==NULL)
+ {
+  Halt("Can't allocate memory for map chunks");
+ }
+ for (slot=0;slot<slot_amount;++slot)
+ {
+  slots[slot].tiles=static_cast<unsigned short int*>(calloc(tile_length*head.layers,sizeof(unsigned short int)));
+  slots[slot].collision=static_cast<unsigned char*>(calloc(collision_length,sizeof(unsigned char)));
+  if ((slots[slot].tiles==NULL)||(slots[slot].collision==NULL))
+  {
+   Halt("Can't allocate memory for map chunks");
+  }
+  slots[slot].chunk=0;
+  slots[slot].stamp=0;
+  slots[slot].distance=0;
+  slots[slot].state=MAP_SLOT_EMPTY;
+  slots[slot].ready=false;
+ }
+
+}
+
+void Map_Stream::start_stream()
+{
+ run=true;
+ if (pthread_create(&stream,NULL,map_stream_worker,this)!=0)
+ {
+  Halt("Can't start map stream");
+ }
+
+}
+
+void Map_Stream::stop_stream()
+{
+ if (run==true)
+ {
+  pthread_mutex_lock(&lock);
+  run=false;
+  pthread_cond_signal(&signal);
+  pthread_mutex_unlock(&lock);
+  pthread_join(stream,NULL);
+ }
+
+}
+
+size_t Map_Stream::get_victim()
+{
+ size_t slot,victim;
+ victim=MAP_NONE;
+ for (slot=0;slot<slot_amount;++slot)
+ {
+  if (slots[slot].state==MAP_SLOT_EMPTY)
+  {
+   victim=slot;
+   break;
+  }
+  if ((slots[slot].state!=MAP_SLOT_LOADING)&&(slots[slot].stamp!=stamp))
+  {
+   if ((victim==MAP_NONE)||(slots[slot].stamp<slots[victim].stamp)) victim=slot;
+  }
+
+ }
+ return victim;
+}
+
+void Map_Stream::request_chunk(const unsigned long int chunk_x,const unsigned long int chunk_y,const unsigned long int distance)
+{
+ size_t chunk,slot;
+ chunk=static_cast<size_t>(chunk_x)+static_cast<size_t>(chunk_y)*static_cast<size_t>(chunk_columns);
+ slot=chunk_slots[chunk];
+ if (slot==MAP_NONE)
+ {
+  slot=this->get_victim();
+  if (slot!=MAP_NONE)
+  {
+   if (slots[slot].state!=MAP_SLOT_EMPTY) chunk_slots[slots[slot].chunk]=MAP_NONE;
+   slots[slot].chunk=chunk;
+   slots[slot].state=MAP_SLOT_REQUESTED;
+   slots[slot].ready=false;
+   chunk_slots[chunk]=slot;
+  }
+
+ }
+ if (slot!=MAP_NONE)
+ {
+  slots[slot].stamp=stamp;
+  slots[slot].distance=distance;
+ }
+
+}
+
+void Map_Stream::read_chunk(MAP_Slot &target,const unsigned long int chunk)
+{
+ size_t length;
+ length=tile_length*head.layers*sizeof(unsigned short int);
+ if (index[chunk].length==0)
+ {
+  memset(target.tiles,0,length);
+  memset(target.collision,0,collision_length);
+ }
+ else
+ {
+  this->read_device(target.tiles,length,index[chunk].offset);
+  this->read_device(target.collision,collision_length,index[chunk].offset+length);
+ }
+
+}
+
+const MAP_Slot *Map_Stream::get_slot(const unsigned long int x,const unsigned long int y)
+{
+ size_t slot;
+ const MAP_Slot *target;
+ target=NULL;
+ if ((chunk_slots!=NULL)&&(x<head.width)&&(y<head.height))
+ {
+  slot=chunk_slots[static_cast<size_t>(x/head.chunk_width)+static_cast<size_t>(y/head.chunk_height)*static_cast<size_t>(chunk_columns)];
+  if (slot!=MAP_NONE)
+  {
+   if (slots[slot].ready==true) target=slots+slot;
+  }
+  if (target==NULL) ++missed;
+ }
+ return target;
+}
+
+void Map_Stream::set_chunk_limit(const size_t limit)
+{
+ chunk_limit=limit;
+}
+
+size_t Map_Stream::get_chunk_limit() const
+{
+ return chunk_limit;
+}
+
+void Map_Stream::set_margin(const unsigned long int chunks)
+{
+ margin=chunks;
+}
+
+unsigned long int Map_Stream::get_margin() const
+{
+ return margin;
+}
 
+void Map_Stream::open(const char *name)
+{
+ this->close();
+ this->open_device(name);
+ this->read_head();
+ this->read_index();
+ this->create_slots();
+ this->start_stream();
 }
 
-unsigned char *Image::create_buffer(const size_t length)
+void Map_Stream::close()
 {
- unsigned char *result;
- result=NULL;
- try
+ size_t slot;
+ this->stop_stream();
+ if (slots!=NULL)
+ {
+  for (slot=0;slot<slot_amount;++slot)
+  {
+   if (slots[slot].tiles!=NULL) free(slots[slot].tiles);
+   if (slots[slot].collision!=NULL) free(slots[slot].collision);
+  }
+  free(slots);
+  slots=NULL;
+ }
+ if (index!=NULL)
  {
-  result=new unsigned char[length];
+  free(index);
+  index=NULL;
  }
- catch (...)
+ if (chunk_slots!=NULL)
  {
-  Halt("Can't allocate memory for image buffer");
+  free(chunk_slots);
+  chunk_slots=NULL;
  }
- return result;
+ if (device!=-1)
+ {
+  ::close(device);
+  device=-1;
+ }
+ slot_amount=0;
+ missed=0;
+ memset(&head,0,sizeof(MAP_head));
 }
 
-void Image::clear_buffer()
+unsigned long int Map_Stream::get_width() const
 {
- if (data!=NULL)
- {
-  delete[] data;
-  data=NULL;
- }
+ return head.width;
+}
 
+unsigned long int Map_Stream::get_height() const
+{
+ return head.height;
 }
 
-void Image::load_tga(const char *name)
+unsigned long int Map_Stream::get_layers() const
 {
- Input_File target;
- size_t index,position,amount,compressed_length,uncompressed_length;
- unsigned char *compressed;
- unsigned char *uncompressed;
- TGA_head head;
- TGA_map color_map;
- TGA_image image;
- this->clear_buffer();
- target.open(name);
- compressed_length=static_cast<size_t>(target.get_length()-18);
- target.read(&head,3);
- target.read(&color_map,5);
- target.read(&image,10);
- if ((head.color_map!=0)||(image.color!=24))
+ return head.layers;
+}
+
+unsigned long int Map_Stream::get_chunk_width() const
+{
+ return head.chunk_width;
+}
+
+unsigned long int Map_Stream::get_chunk_height() const
+{
+ return head.chunk_height;
+}
+
+void Map_Stream::set_focus(const unsigned long int x,const unsigned long int y)
+{
+ focus_x=x;
+ focus_y=y;
+}
+
+void Map_Stream::update()
+{
+ unsigned long int center_x,center_y,distance,chunk_x,chunk_y,left,top,right,bottom;
+ size_t slot;
+ if ((slots!=NULL)&&(chunk_columns>0)&&(chunk_rows>0))
  {
-  Halt("Invalid image format");
+  pthread_mutex_lock(&lock);
+  for (slot=0;slot<slot_amount;++slot)
+  {
+   slots[slot].ready=(slots[slot].state==MAP_SLOT_READY);
+  }
+  ++stamp;
+  center_x=focus_x/head.chunk_width;
+  center_y=focus_y/head.chunk_height;
+  if (center_x>=chunk_columns) center_x=chunk_columns-1;
+  if (center_y>=chunk_rows) center_y=chunk_rows-1;
+  for (distance=0;distance<=margin;++distance)
+  {
+   left=0;
+   top=0;
+   if (center_x>distance) left=center_x-distance;
+   if (center_y>distance) top=center_y-distance;
+   right=center_x+distance;
+   bottom=center_y+distance;
+   if (right>=chunk_columns) right=chunk_columns-1;
+   if (bottom>=chunk_rows) bottom=chunk_rows-1;
+   for (chunk_y=top;chunk_y<=bottom;++chunk_y)
+   {
+    for (chunk_x=left;chunk_x<=right;++chunk_x)
+    {
+     if ((chunk_x+distance==center_x)||(chunk_x==center_x+distance)||(chunk_y+distance==center_y)||(chunk_y==center_y+distance))
+     {
+      this->request_chunk(chunk_x,chunk_y,distance);
+     }
+
+    }
+
+   }
+
+  }
+  pthread_cond_signal(&signal);
+  pthread_mutex_unlock(&lock);
  }
- if (head.type!=2)
+
+}
+
+bool Map_Stream::check_resident(const unsigned long int x,const unsigned long int y)
+{
+ return this->get_slot(x,y)!=NULL;
+}
+
+unsigned short int Map_Stream::get_tile(const unsigned long int layer,const unsigned long int x,const unsigned long int y)
+{
+ unsigned short int tile;
+ const MAP_Slot *target;
+ tile=0;
+ if (layer<head.layers)
  {
-  if (head.type!=10)
+  target=this->get_slot(x,y);
+  if (target!=NULL)
   {
-   Halt("Invalid image format");
+   tile=target->tiles[tile_length*layer+static_cast<size_t>(x%head.chunk_width)+static_cast<size_t>(y%head.chunk_height)*static_cast<size_t>(head.chunk_width)];
   }
 
  }
- index=0;
- position=0;
- width=image.width;
- height=image.height;
- uncompressed_length=this->get_length();
- uncompressed=this->create_buffer(uncompressed_length);
- if (head.type==2)
+ return tile;
+}
+
+bool Map_Stream::check_collision(const unsigned long int x,const unsigned long int y)
+{
+ bool result;
+ size_t position;
+ const MAP_Slot *target;
+ result=false;
+ target=this->get_slot(x,y);
+ if (target!=NULL)
+ {
+  position=static_cast<size_t>(x%head.chunk_width)+static_cast<size_t>(y%head.chunk_height)*static_cast<size_t>(head.chunk_width);
+  result=((target->collision[position/CHAR_BIT]>>(position%CHAR_BIT))&1)!=0;
+ }
+ return result;
+}
+
+size_t Map_Stream::get_resident()
+{
+ size_t slot,amount;
+ amount=0;
+ pthread_mutex_lock(&lock);
+ for (slot=0;slot<slot_amount;++slot)
  {
-  target.read(uncompressed,uncompressed_length);
+  if (slots[slot].state==MAP_SLOT_READY) ++amount;
  }
- if (head.type==10)
+ pthread_mutex_unlock(&lock);
+ return amount;
+}
+
+unsigned long int Map_Stream::get_missed() const
+{
+ return missed;
+}
+
+void Map_Stream::load_chunks()
+{
+ size_t slot,target;
+ unsigned long int chunk;
+ pthread_mutex_lock(&lock);
+ while (run==true)
  {
-  compressed=this->create_buffer(compressed_length);
-  target.read(compressed,compressed_length);
-  while(index<uncompressed_length)
+  target=MAP_NONE;
+  for (slot=0;slot<slot_amount;++slot)
   {
-   if (compressed[position]<128)
+   if (slots[slot].state==MAP_SLOT_REQUESTED)
    {
-    amount=compressed[position]+1;
-    amount*=3;
-    memmove(uncompressed+index,compressed+(position+1),amount);
-    index+=amount;
-    position+=1+amount;
-   }
-   else
-   {
-    for (amount=compressed[position]-127;amount>0;--amount)
+    if ((target==MAP_NONE)||(slots[slot].stamp>slots[target].stamp))
+    {
+     target=slot;
+    }
+    else
     {
-     memmove(uncompressed+index,compressed+(position+1),3);
-     index+=3;
+     if ((slots[slot].stamp==slots[target].stamp)&&(slots[slot].distance<slots[target].distance)) target=slot;
     }
-    position+=4;
+
    }
 
   }
-  delete[] compressed;
+  if (target==MAP_NONE)
+  {
+   pthread_cond_wait(&signal,&lock);
+  }
+  else
+  {
+   slots[target].state=MAP_SLOT_LOADING;
+   chunk=slots[target].chunk;
+   pthread_mutex_unlock(&lock);
+   this->read_chunk(slots[target],chunk);
+   pthread_mutex_lock(&lock);
+   slots[target].state=MAP_SLOT_READY;
+  }
+
  }
- target.close();
- data=uncompressed;
+ pthread_mutex_unlock(&lock);
 }
 
-void Image::load_pcx(const char *name)
+Map_Stream* Map_Stream::get_handle()
 {
- Input_File target;
- unsigned long int x,y;
- size_t index,position,line,row,length,uncompressed_length;
- unsigned char repeat;
- unsigned char *original;
- unsigned char *uncompressed;
- PCX_head head;
- this->clear_buffer();
+ return this;
+}
+
+Map_Writer::Map_Writer()
+{
+ memset(&head,0,sizeof(MAP_head));
+ index=NULL;
+ tile_length=0;
+ collision_length=0;
+ chunk_columns=0;
+ chunk_rows=0;
+ position=0;
+}
+
+Map_Writer::~Map_Writer()
+{
+ this->close();
+}
+
+bool Map_Writer::check_empty(const unsigned char *data,const size_t length) const
+{
+ bool result;
+ size_t offset;
+ result=true;
+ if (data!=NULL)
+ {
+  for (offset=0;offset<length;++offset)
+  {
+   if (data[offset]!=0)
+   {
+    result=false;
+    break;
+   }
+
+  }
+
+ }
+ return result;
+}
+
+void Map_Writer::create(const char *name,const unsigned long int width,const unsigned long int height,const unsigned short int chunk_width,const unsigned short int chunk_height,const unsigned short int layers)
+{
+ size_t amount;
+ if ((chunk_width==0)||(chunk_height==0)||(layers==0))
+ {
+  Halt("Incorrect map format");
+ }
+ this->close();
+ memcpy(head.signature,"DMAP",4);
+ head.width=width;
+ head.height=height;
+ head.chunk_width=chunk_width;
+ head.chunk_height=chunk_height;
+ head.layers=layers;
+ head.flags=0;
+ chunk_columns=(width+chunk_width-1)/chunk_width;
+ chunk_rows=(height+chunk_height-1)/chunk_height;
+ tile_length=static_cast<size_t>(chunk_width)*static_cast<size_t>(chunk_height);
+ collision_length=(tile_length+CHAR_BIT-1)/CHAR_BIT;
+ amount=static_cast<size_t>(chunk_columns)*static_cast<size_t>(chunk_rows);
+ index=static_cast<MAP_Entry*>(calloc(amount+1,sizeof(MAP_Entry)));
+ if (index==NULL)
+ {
+  Halt("Can't allocate memory for map index");
+ }
+ position=MAP_HEAD_LENGTH+amount*MAP_ENTRY_LENGTH;
  target.open(name);
- length=static_cast<size_t>(target.get_length()-128);
- target.read(&head,128);
- if ((head.color*head.planes!=24)&&(head.compress!=1))
+ target.write(&head,MAP_HEAD_LENGTH);
+}
+
+void Map_Writer::write_chunk(const unsigned long int chunk_x,const unsigned long int chunk_y,unsigned short int *tiles,unsigned char *collision)
+{
+ size_t chunk,length;
+ unsigned char *data;
+ if ((index!=NULL)&&(chunk_x<chunk_columns)&&(chunk_y<chunk_rows))
  {
-  Halt("Incorrect image format");
+  chunk=static_cast<size_t>(chunk_x)+static_cast<size_t>(chunk_y)*static_cast<size_t>(chunk_columns);
+  length=tile_length*head.layers*sizeof(unsigned short int);
+  index[chunk].offset=0;
+  index[chunk].length=0;
+  if ((this->check_empty(reinterpret_cast<unsigned char*>(tiles),length)==false)||(this->check_empty(collision,collision_length)==false))
+  {
+   data=static_cast<unsigned char*>(calloc(length+collision_length,sizeof(unsigned char)));
+   if (data==NULL)
+   {
+    Halt("Can't allocate memory for map chunk");
+   }
+   if (tiles!=NULL) memcpy(data,tiles,length);
+   if (collision!=NULL) memcpy(data+length,collision,collision_length);
+   target.set_position(position);
+   target.write(data,length+collision_length);
+   free(data);
+   index[chunk].offset=position;
+   index[chunk].length=length+collision_length;
+   position+=length+collision_length;
+  }
+
  }
- width=head.max_x-head.min_x+1;
- height=head.max_y-head.min_y+1;
- row=static_cast<size_t>(width)*3;
- line=static_cast<size_t>(head.planes)*static_cast<size_t>(head.plane_length);
- uncompressed_length=row*height;
- index=0;
- position=0;
- original=this->create_buffer(length);
- uncompressed=this->create_buffer(uncompressed_length);
- target.read(original,length);
- target.close();
- while (index<length)
+
+}
+
+void Map_Writer::close()
+{
+ size_t chunk,amount;
+ if (index!=NULL)
  {
-  if (original[index]<192)
+  amount=static_cast<size_t>(chunk_columns)*static_cast<size_t>(chunk_rows);
+  target.set_position(MAP_HEAD_LENGTH);
+  for (chunk=0;chunk<amount;++chunk)
   {
-   uncompressed[position]=original[index];
-   ++position;
-   ++index;
+   target.write(index+chunk,MAP_ENTRY_LENGTH);
   }
-  else
+  target.close();
+  free(index);
+  index=NULL;
+ }
+
+}
+
+Text::Text()
+{
+ current_x=0;
+ current_y=0;
+ font=NULL;
+}
+
+Text::~Text()
+{
+
+}
+
+void Text::increase_position()
+{
+ font->increase_x(font->get_width());
+}
+
+void Text::restore_position()
+{
+ font->set_position(current_x,current_y);
+}
+
+void Text::set_position(const unsigned long int x,const unsigned long int y)
+{
+ font->set_position(x,y);
+ current_x=x;
+ current_y=y;
+}
+
+void Text::load_font(Sprite *target)
+{
+ font=target;
+ font->set_frames(128);
+ font->set_kind(HORIZONTAL_STRIP);
+}
+
+void Text::draw_character(const char target)
+{
+ font->set_target(static_cast<unsigned char>(target)+1);
+ font->draw_sprite();
+}
+
+void Text::draw_text(const char *text)
+{
+ size_t index,length;
+ length=strlen(text);
+ this->restore_position();
+ for (index=0;index<length;++index)
+ {
+  if (text[index]<32) continue;
+  this->draw_character(text[index]);
+  this->increase_position();
+ }
+ this->restore_position();
+}
+
+void Text::draw_character(const unsigned long int x,const unsigned long int y,const char target)
+{
+ this->set_position(x,y);
+ this->draw_character(target);
+}
+
+void Text::draw_text(const unsigned long int x,const unsigned long int y,const char *text)
+{
+ this->set_position(x,y);
+ this->draw_text(text);
+}
+
+Font::Font()
+{
+ proportional=false;
+ tint=false;
+ color=0;
+ spacing=1;
+ glyph_width=0;
+ glyph_height=0;
+ font_revision=0;
+ pixels=NULL;
+ spans=NULL;
+ this->clear_font();
+}
+
+Font::~Font()
+{
+ this->clear_font();
+}
+
+void Font::clear_font()
+{
+ size_t index;
+ if (pixels!=NULL)
+ {
+  free(pixels);
+  pixels=NULL;
+ }
+ if (spans!=NULL)
+ {
+  free(spans);
+  spans=NULL;
+ }
+ for (index=0;index<FONT_GLYPHS;++index)
+ {
+  glyphs[index].first=0;
+  glyphs[index].amount=0;
+  glyphs[index].left=0;
+  glyphs[index].width=0;
+ }
+ glyph_width=0;
+ glyph_height=0;
+}
+
+size_t Font::count_spans(size_t &length)
+{
+ unsigned long int x,y,width;
+ size_t amount;
+ amount=0;
+ length=0;
+ width=glyph_width*FONT_GLYPHS;
+ for (y=0;y<glyph_height;++y)
+ {
+  for (x=0;x<width;++x)
   {
-   for (repeat=original[index]-192;repeat>0;--repeat)
+   if (this->compare_pixels(0,this->get_offset(0,x,y))==true)
    {
-    uncompressed[position]=original[index+1];
-    ++position;
+    if ((x%glyph_width==0)||(this->compare_pixels(0,this->get_offset(0,x-1,y))==false)) ++amount;
+    ++length;
    }
-   index+=2;
-  }
 
- }
- delete[] original;
- original=this->create_buffer(uncompressed_length);
- for (x=0;x<width;++x)
- {
-  for (y=0;y<height;++y)
-  {
-   index=static_cast<size_t>(x)*3+static_cast<size_t>(y)*row;
-   position=static_cast<size_t>(x)+static_cast<size_t>(y)*line;
-   original[index]=uncompressed[position+2*static_cast<size_t>(head.plane_length)];
-   original[index+1]=uncompressed[position+static_cast<size_t>(head.plane_length)];
-   original[index+2]=uncompressed[position];
   }
 
  }
- delete[] uncompressed;
- data=original;
+ return amount;
 }
 
-unsigned long int Image::get_width() const
+void Font::create_glyph(const size_t target,size_t &span,size_t &offset)
 {
- return width;
-}
+ unsigned long int x,y,left,right;
+ size_t position;
+ IMG_Pixel *image;
+ image=this->get_image();
+ left=glyph_width;
+ right=0;
+ glyphs[target].first=span;
+ for (y=0;y<glyph_height;++y)
+ {
+  for (x=0;x<glyph_width;++x)
+  {
+   position=this->get_offset(0,target*glyph_width+x,y);
+   if (this->compare_pixels(0,position)==true)
+   {
+    if ((x==0)||(this->compare_pixels(0,position-1)==false))
+    {
+     spans[span].x=x;
+     spans[span].y=y;
+     spans[span].length=0;
+     spans[span].offset=offset;
+     ++span;
+    }
+    ++spans[span-1].length;
+    pixels[offset]=pack_pixel(image[position].red,image[position].green,image[position].blue);
+    ++offset;
+    if (x<left) left=x;
+    if (x>right) right=x;
+   }
 
-unsigned long int Image::get_height() const
-{
- return height;
-}
+  }
 
-size_t Image::get_length() const
-{
- return static_cast<size_t>(width)*static_cast<size_t>(height)*3;
-}
+ }
+ glyphs[target].amount=span-glyphs[target].first;
+ if (glyphs[target].amount>0)
+ {
+  glyphs[target].left=left;
+  glyphs[target].width=right-left+1;
+ }
 
-unsigned char *Image::get_data()
-{
- return data;
 }
 
-void Image::destroy_image()
+void Font::create_font()
 {
- width=0;
- height=0;
- this->clear_buffer();
-}
+ size_t index,amount,length,span,offset;
+ glyph_width=this->get_image_width()/FONT_GLYPHS;
+ glyph_height=this->get_image_height();
+ if ((glyph_width>0)&&(glyph_height>0))
+ {
+  amount=this->count_spans(length);
+  spans=static_cast<FNT_Span*>(calloc(amount+1,sizeof(FNT_Span)));
+  pixels=static_cast<unsigned short int*>(calloc(length+1,sizeof(unsigned short int)));
+  if ((spans==NULL)||(pixels==NULL))
+  {
+   Halt("Can't allocate memory for font glyphs");
+  }
+  span=0;
+  offset=0;
+  for (index=0;index<FONT_GLYPHS;++index)
+  {
+   this->create_glyph(index,span,offset);
+  }
 
-Surface::Surface()
-{
- width=0;
- height=0;
- image=NULL;
- surface=NULL;
-}
+ }
 
-Surface::~Surface()
-{
- surface=NULL;
- if (image!=NULL) free(image);
 }
 
-IMG_Pixel *Surface::create_buffer(const unsigned long int image_width,const unsigned long int image_height)
+void Font::prepare_font()
 {
- IMG_Pixel *result;
- size_t length;
- length=static_cast<size_t>(image_width)*static_cast<size_t>(image_height);
- result=reinterpret_cast<IMG_Pixel*>(calloc(length,3));
- if (result==NULL)
+ if (font_revision!=this->get_revision())
  {
-  Halt("Can't allocate memory for image buffer");
+  this->clear_font();
+  if (this->get_image()!=NULL) this->create_font();
+  font_revision=this->get_revision();
  }
- return result;
-}
 
-void Surface::save()
-{
- surface->save();
 }
 
-void Surface::restore()
+const FNT_Glyph *Font::get_glyph(const char target) const
 {
- surface->restore();
+ const FNT_Glyph *glyph;
+ glyph=NULL;
+ if ((static_cast<unsigned char>(target)>=32)&&(static_cast<unsigned char>(target)<FONT_GLYPHS)&&(spans!=NULL))
+ {
+  glyph=glyphs+static_cast<unsigned char>(target);
+ }
+ return glyph;
 }
 
-void Surface::clear_buffer()
+unsigned long int Font::get_advance(const FNT_Glyph *glyph) const
 {
- if (image!=NULL)
+ unsigned long int advance;
+ advance=glyph_width;
+ if (proportional==true)
  {
-  free(image);
-  image=NULL;
- }
+  if (glyph->amount==0)
+  {
+   advance=glyph_width/2;
+  }
+  else
+  {
+   advance=glyph->width+spacing;
+  }
 
+ }
+ return advance;
 }
 
-void Surface::load_from_buffer(Image &buffer)
+unsigned long int Font::get_shift(const FNT_Glyph *glyph) const
 {
- width=buffer.get_width();
- height=buffer.get_height();
- this->clear_buffer();
- image=this->create_buffer(width,height);
- memmove(image,buffer.get_data(),buffer.get_length());
+ unsigned long int shift;
+ shift=0;
+ if (proportional==true) shift=glyph->left;
+ return shift;
 }
 
-void Surface::set_width(const unsigned long int image_width)
+void Font::draw_glyph(unsigned short int *target,const unsigned long int width,const unsigned long int height,const unsigned long int x,const unsigned long int y,const FNT_Glyph *glyph)
 {
- width=image_width;
-}
+ unsigned long int index,stop,start_x,start_y,length,shift;
+ unsigned short int *output;
+ shift=this->get_shift(glyph);
+ stop=glyph->first+glyph->amount;
+ for (index=glyph->first;index<stop;++index)
+ {
+  start_y=y+spans[index].y;
+  if (start_y>=height) break;
+  start_x=x+spans[index].x-shift;
+  if (start_x>=width) continue;
+  length=spans[index].length;
+  if (length>width-start_x) length=width-start_x;
+  output=target+this->get_offset(0,start_x,start_y,width);
+  if (tint==true)
+  {
+   for (;length>0;--length)
+   {
+    *output=color;
+    ++output;
+   }
 
-void Surface::set_height(const unsigned long int image_height)
-{
- height=image_height;
-}
+  }
+  else
+  {
+   memcpy(output,pixels+spans[index].offset,static_cast<size_t>(length)*sizeof(unsigned short int));
+  }
+
+ }
 
-void Surface::set_buffer(IMG_Pixel *buffer)
-{
- image=buffer;
 }
 
-size_t Surface::get_offset(const unsigned long int start,const unsigned long int x,const unsigned long int y,const unsigned long int target_width)
+void Font::load_font(Image &buffer)
 {
- return static_cast<size_t>(start)+static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(target_width);
+ this->load_from_buffer(buffer);
+ this->prepare_font();
 }
 
-size_t Surface::get_offset(const unsigned long int start,const unsigned long int x,const unsigned long int y) const
+void Font::set_proportional(const bool enabled)
 {
- return static_cast<size_t>(start)+static_cast<size_t>(x)+static_cast<size_t>(y)*static_cast<size_t>(width);
+ proportional=enabled;
 }
 
-void Surface::draw_image_pixel(const size_t offset,const unsigned long int x,const unsigned long int y)
+bool Font::get_proportional() const
 {
- surface->draw_pixel(x,y,image[offset].red,image[offset].green,image[offset].blue);
+ return proportional;
 }
 
-bool Surface::compare_pixels(const size_t first,const size_t second) const
+void Font::set_spacing(const unsigned long int amount)
 {
- bool result;
- result=false;
- if (image[first].red!=image[second].red)
- {
-  result=true;
-  goto finish;
- }
- if (image[first].green!=image[second].green)
- {
-  result=true;
-  goto finish;
- }
- if (image[first].blue!=image[second].blue)
- {
-  result=true;
-  goto finish;
- }
- finish: ;
- return result;
+ spacing=amount;
 }
 
-unsigned long int Surface::get_surface_width() const
+unsigned long int Font::get_spacing() const
 {
- return surface->get_frame_width();
+ return spacing;
 }
 
-unsigned long int Surface::get_surface_height() const
+void Font::set_tint(const unsigned char red,const unsigned char green,const unsigned char blue)
 {
- return surface->get_frame_height();
+ color=pack_pixel(red,green,blue);
+ tint=true;
 }
 
-void Surface::initialize(Screen *screen)
+void Font::clear_tint()
 {
- surface=screen;
+ tint=false;
 }
 
-size_t Surface::get_length() const
+bool Font::get_tint() const
 {
- return static_cast<size_t>(width)*static_cast<size_t>(height)*3;
+ return tint;
 }
 
-IMG_Pixel *Surface::get_image()
+unsigned long int Font::get_font_width() const
 {
- return image;
+ return glyph_width;
 }
 
-unsigned long int Surface::get_image_width() const
+unsigned long int Font::get_font_height() const
 {
- return width;
+ return glyph_height;
 }
 
-unsigned long int Surface::get_image_height() const
+unsigned long int Font::get_glyph_width(const char target)
 {
- return height;
+ unsigned long int width;
+ const FNT_Glyph *glyph;
+ width=0;
+ this->prepare_font();
+ glyph=this->get_glyph(target);
+ if (glyph!=NULL) width=this->get_advance(glyph);
+ return width;
 }
 
-void Surface::mirror_image(const MIRROR_TYPE kind)
+unsigned long int Font::get_text_width(const char *text)
 {
- unsigned long int x,y,index;
- IMG_Pixel *mirrored_image;
- x=0;
- y=0;
- mirrored_image=this->create_buffer(width,height);
- if (kind==MIRROR_HORIZONTAL)
+ size_t index;
+ unsigned long int width,line;
+ const FNT_Glyph *glyph;
+ width=0;
+ line=0;
+ this->prepare_font();
+ for (index=0;text[index]!=0;++index)
  {
-  for (index=width*height;index>0;--index)
+  if (text[index]=='\n')
   {
-   mirrored_image[this->get_offset(0,x,y)]=image[this->get_offset(0,(width-x-1),y)];
-   ++x;
-   if (x==width)
-   {
-    x=0;
-    ++y;
-   }
-
+   line=0;
+   continue;
   }
-
+  glyph=this->get_glyph(text[index]);
+  if (glyph!=NULL) line+=this->get_advance(glyph);
+  if (line>width) width=line;
  }
- if (kind==MIRROR_VERTICAL)
- {
-  for (index=width*height;index>0;--index )
-  {
-   mirrored_image[this->get_offset(0,x,y)]=image[this->get_offset(0,x,(height-y-1))];
-   ++x;
-   if (x==width)
-   {
-    x=0;
-    ++y;
-   }
-
-  }
+ return width;
+}
 
+unsigned long int Font::get_text_height(const char *text)
+{
+ size_t index;
+ unsigned long int lines;
+ lines=1;
+ this->prepare_font();
+ for (index=0;text[index]!=0;++index)
+ {
+  if (text[index]=='\n') ++lines;
  }
- free(image);
- image=mirrored_image;
+ return lines*glyph_height;
 }
 
-void Surface::resize_image(const unsigned long int new_width,const unsigned long int new_height)
+void Font::draw_text(unsigned short int *target,const unsigned long int width,const unsigned long int height,const unsigned long int x,const unsigned long int y,const char *text)
 {
- float x_ratio,y_ratio;
- unsigned long int x,y;
- size_t index,position;
- IMG_Pixel *scaled_image;
- scaled_image=this->create_buffer(new_width,new_height);
- x_ratio=static_cast<float>(width)/static_cast<float>(new_width);
- y_ratio=static_cast<float>(height)/static_cast<float>(new_height);
- for (x=0;x<new_width;++x)
+ size_t index;
+ unsigned long int current_x,current_y;
+ const FNT_Glyph *glyph;
+ this->prepare_font();
+ current_x=x;
+ current_y=y;
+ for (index=0;text[index]!=0;++index)
  {
-  for (y=0;y<new_height;++y)
+  if (text[index]=='\n')
   {
-   index=this->get_offset(0,x,y,new_width);
-   position=this->get_offset(0,(x_ratio*static_cast<float>(x)),(y_ratio*static_cast<float>(y)),width);
-   scaled_image[index]=image[position];
+   current_x=x;
+   current_y+=glyph_height;
+   continue;
   }
-
+  glyph=this->get_glyph(text[index]);
+  if (glyph==NULL) continue;
+  if ((current_x<width)&&(current_y<height))
+  {
+   this->draw_glyph(target,width,height,current_x,current_y,glyph);
+  }
+  current_x+=this->get_advance(glyph);
  }
- free(image);
- image=scaled_image;
- width=new_width;
- height=new_height;
-}
 
-void Surface::horizontal_mirror()
-{
- this->mirror_image(MIRROR_HORIZONTAL);
 }
 
-void Surface::vertical_mirror()
+void Font::draw_text(const unsigned long int x,const unsigned long int y,const char *text)
 {
- this->mirror_image(MIRROR_VERTICAL);
+ this->draw_text(this->get_surface_buffer(),this->get_surface_width(),this->get_surface_height(),x,y,text);
 }
 
-Canvas::Canvas()
+void Font::draw_character(const unsigned long int x,const unsigned long int y,const char target)
 {
- start=0;
- frame=1;
- frames=1;
+ char text[2];
+ text[0]=target;
+ text[1]=0;
+ this->draw_text(x,y,text);
 }
 
-Canvas::~Canvas()
+size_t Font::get_text_spans(const char *text,size_t &length)
 {
+ size_t index,amount,span;
+ const FNT_Glyph *glyph;
+ amount=0;
+ length=0;
+ this->prepare_font();
+ for (index=0;text[index]!=0;++index)
+ {
+  glyph=this->get_glyph(text[index]);
+  if (glyph==NULL) continue;
+  amount+=glyph->amount;
+  for (span=glyph->first;span<glyph->first+glyph->amount;++span)
+  {
+   length+=spans[span].length;
+  }
 
+ }
+ return amount;
 }
 
-void Canvas::set_frame(const unsigned long int target)
+void Font::create_text_spans(const char *text,FNT_Span *target,unsigned short int *output)
 {
- if (target>0)
+ size_t index,span,amount,offset,position;
+ unsigned long int current_x,current_y,shift;
+ const FNT_Glyph *glyph;
+ this->prepare_font();
+ current_x=0;
+ current_y=0;
+ amount=0;
+ offset=0;
+ for (index=0;text[index]!=0;++index)
  {
-  if (target<=frames) frame=target;
+  if (text[index]=='\n')
+  {
+   current_x=0;
+   current_y+=glyph_height;
+   continue;
+  }
+  glyph=this->get_glyph(text[index]);
+  if (glyph==NULL) continue;
+  shift=this->get_shift(glyph);
+  for (span=glyph->first;span<glyph->first+glyph->amount;++span)
+  {
+   target[amount].x=current_x+spans[span].x-shift;
+   target[amount].y=current_y+spans[span].y;
+   target[amount].length=spans[span].length;
+   target[amount].offset=offset;
+   if (tint==true)
+   {
+    for (position=0;position<spans[span].length;++position)
+    {
+     output[offset+position]=color;
+    }
+
+   }
+   else
+   {
+    memcpy(output+offset,pixels+spans[span].offset,static_cast<size_t>(spans[span].length)*sizeof(unsigned short int));
+   }
+   offset+=spans[span].length;
+   ++amount;
+  }
+  current_x+=this->get_advance(glyph);
  }
 
 }
 
-void Canvas::increase_frame()
+void Font::draw_spans(const FNT_Span *target,const size_t amount,const unsigned short int *source,const unsigned long int x,const unsigned long int y)
 {
- ++frame;
- if (frame>frames)
+ size_t index;
+ unsigned long int start_x,start_y,length,width,height;
+ unsigned short int *output;
+ width=this->get_surface_width();
+ height=this->get_surface_height();
+ output=this->get_surface_buffer();
+ for (index=0;index<amount;++index)
  {
-  frame=1;
+  start_x=x+target[index].x;
+  start_y=y+target[index].y;
+  if ((start_x>=width)||(start_y>=height)) continue;
+  length=target[index].length;
+  if (length>width-start_x) length=width-start_x;
+  memcpy(output+this->get_offset(0,start_x,start_y,width),source+target[index].offset,static_cast<size_t>(length)*sizeof(unsigned short int));
  }
 
 }
 
-void Canvas::set_frames(const unsigned long int amount)
-{
- if (amount>1) frames=amount;
-}
-
-unsigned long int Canvas::get_frames() const
+Font* Font::get_handle()
 {
- return frames;
+ return this;
 }
 
-unsigned long int Canvas::get_frame() const
+Text_Label::Text_Label()
 {
- return frame;
+ font=NULL;
+ text=NULL;
+ capacity=0;
+ spans=NULL;
+ span_amount=0;
+ pixels=NULL;
+ label_x=0;
+ label_y=0;
+ label_width=0;
+ label_height=0;
+ renders=0;
+ changed=true;
 }
 
-void Canvas::load_image(Image &buffer)
+Text_Label::~Text_Label()
 {
- this->load_from_buffer(buffer);
+ this->clear_label();
 }
 
-Background::Background()
+void Text_Label::clear_spans()
 {
- background_width=0;
- background_height=0;
- maximum_width=0;
- maximum_height=0;
- current=0;
- current_kind=NORMAL_BACKGROUND;
+ if (spans!=NULL)
+ {
+  free(spans);
+  spans=NULL;
+ }
+ if (pixels!=NULL)
+ {
+  free(pixels);
+  pixels=NULL;
+ }
+ span_amount=0;
 }
 
-Background::~Background()
+void Text_Label::clear_label()
 {
-
+ this->clear_spans();
+ if (text!=NULL)
+ {
+  free(text);
+  text=NULL;
+ }
+ capacity=0;
 }
 
-void Background::get_maximum_width()
+void Text_Label::store_text(const char *target)
 {
- maximum_width=background_width;
- if (maximum_width>this->get_surface_width())
+ size_t length;
+ char *buffer;
+ length=strlen(target)+1;
+ if (length>capacity)
  {
-  maximum_width=this->get_surface_width();
+  buffer=static_cast<char*>(realloc(text,length));
+  if (buffer==NULL)
+  {
+   Halt("Can't allocate memory for label text");
+  }
+  text=buffer;
+  capacity=length;
  }
-
+ memcpy(text,target,length);
+ changed=true;
 }
 
-void Background::get_maximum_height()
+void Text_Label::render_label()
 {
- maximum_height=background_height;
- if (maximum_height>this->get_surface_height())
+ size_t length;
+ this->clear_spans();
+ label_width=0;
+ label_height=0;
+ if ((font!=NULL)&&(text!=NULL))
  {
-  maximum_height=this->get_surface_height();
+  span_amount=font->get_text_spans(text,length);
+  spans=static_cast<FNT_Span*>(calloc(span_amount+1,sizeof(FNT_Span)));
+  pixels=static_cast<unsigned short int*>(calloc(length+1,sizeof(unsigned short int)));
+  if ((spans==NULL)||(pixels==NULL))
+  {
+   Halt("Can't allocate memory for label");
+  }
+  font->create_text_spans(text,spans,pixels);
+  label_width=font->get_text_width(text);
+  label_height=font->get_text_height(text);
+  ++renders;
  }
+ changed=false;
+}
 
+void Text_Label::load_font(Font *target)
+{
+ font=target;
+ changed=true;
 }
 
-void Background::slow_draw_background()
+void Text_Label::set_position(const unsigned long int x,const unsigned long int y)
 {
- unsigned long int x,y,index;
- x=0;
- y=0;
- for (index=maximum_width*maximum_height;index>0;--index)
- {
-  this->draw_image_pixel(this->get_offset(start,x,y),x,y);
-  ++x;
-  if (x==maximum_width)
-  {
-   x=0;
-   ++y;
-  }
+ label_x=x;
+ label_y=y;
+}
 
- }
+unsigned long int Text_Label::get_x() const
+{
+ return label_x;
+}
 
+unsigned long int Text_Label::get_y() const
+{
+ return label_y;
 }
 
-void Background::configure_background()
+void Text_Label::set_text(const char *target)
 {
- switch(current_kind)
+ if (text!=NULL)
  {
-  case NORMAL_BACKGROUND:
-  background_width=this->get_image_width();
-  background_height=this->get_image_height();
-  start=0;
-  break;
-  case HORIZONTAL_BACKGROUND:
-  background_width=this->get_image_width()/this->get_frames();
-  background_height=this->get_image_height();
-  start=(this->get_frame()-1)*background_width;
-  break;
-  case VERTICAL_BACKGROUND:
-  background_width=this->get_image_width();
-  background_height=this->get_image_height()/this->get_frames();
-  start=(this->get_frame()-1)*background_width*background_height;
-  break;
+  if (strcmp(text,target)==0) return;
  }
+ this->store_text(target);
+}
 
+void Text_Label::set_number(const unsigned long int value)
+{
+ this->set_number(value,0);
 }
 
-unsigned long int Background::get_width() const
+void Text_Label::set_number(const unsigned long int value,const size_t digits)
 {
- return background_width;
+ char buffer[NUMBER_LENGTH];
+ format_number(buffer,value,digits);
+ this->set_text(buffer);
 }
 
-unsigned long int Background::get_height() const
+const char *Text_Label::get_text() const
 {
- return background_height;
+ return text;
 }
 
-void Background::set_kind(const BACKGROUND_TYPE kind)
+unsigned long int Text_Label::get_width()
 {
- current_kind=kind;
- this->configure_background();
- this->get_maximum_width();
- this->get_maximum_height();
+ if (changed==true) this->render_label();
+ return label_width;
 }
 
-void Background::set_setting(const BACKGROUND_TYPE kind,const unsigned long int frames)
+unsigned long int Text_Label::get_height()
 {
- if (kind!=NORMAL_BACKGROUND) this->set_frames(frames);
- this->set_kind(kind);
+ if (changed==true) this->render_label();
+ return label_height;
 }
 
-void Background::set_target(const unsigned long int target)
+unsigned long int Text_Label::get_renders() const
 {
- this->set_frame(target);
- this->set_kind(current_kind);
+ return renders;
 }
 
-void Background::step()
+void Text_Label::invalidate()
 {
- this->increase_frame();
- this->set_kind(current_kind);
+ changed=true;
 }
 
-void Background::draw_background()
+void Text_Label::draw_label()
 {
- if (current!=this->get_frame())
+ if (changed==true) this->render_label();
+ if ((font!=NULL)&&(span_amount>0))
  {
-  this->slow_draw_background();
-  this->save();
-  current=this->get_frame();
- }
- else
- {
-  this->restore();
+  font->draw_spans(spans,span_amount,pixels,label_x,label_y);
  }
 
 }
 
-Sprite::Sprite()
+void Text_Label::draw_label(const unsigned long int x,const unsigned long int y)
 {
- transparent=true;
- current_x=0;
- current_y=0;
- sprite_width=0;
- sprite_height=0;
- current_kind=SINGLE_SPRITE;
+ this->set_position(x,y);
+ this->draw_label();
 }
 
-Sprite::~Sprite()
+Text_Label* Text_Label::get_handle()
+{
+ return this;
+}
+
+Collision::Collision()
+{
+ first.x=0;
+ first.y=0;
+ first.width=0;
+ first.height=0;
+ first.mask=NULL;
+ second.x=0;
+ second.y=0;
+ second.width=0;
+ second.height=0;
+ second.mask=NULL;
+}
+
+Collision::~Collision()
 {
 
 }
 
-void Sprite::draw_transparent_sprite()
+unsigned long int Collision::get_mask_bits(const Collision_Box &target,const unsigned long int x,const unsigned long int y,const unsigned long int amount) const
 {
- unsigned long int x,y,index;
- x=0;
- y=0;
- for (index=sprite_width*sprite_height;index>0;--index)
+ unsigned long int bits,shift;
+ size_t row,index;
+ bits=ULONG_MAX;
+ if (target.mask!=NULL)
  {
-  if (this->compare_pixels(0,this->get_offset(start,x,y))==true)
-  {
-   this->draw_image_pixel(this->get_offset(start,x,y),x+current_x,y+current_y);
-  }
-  ++x;
-  if (x==sprite_width)
+  row=(static_cast<size_t>(target.width)+MASK_BITS-1)/MASK_BITS;
+  index=static_cast<size_t>(y)*row+x/MASK_BITS;
+  shift=x%MASK_BITS;
+  bits=target.mask[index]>>shift;
+  if ((shift>0)&&((x/MASK_BITS)+1<row))
   {
-   x=0;
-   ++y;
+   bits|=target.mask[index+1]<<(MASK_BITS-shift);
   }
 
  }
+ if (amount<MASK_BITS) bits&=(1UL<<amount)-1;
+ return bits;
+}
 
+void Collision::set_target(const Collision_Box &first_target,const Collision_Box &second_target)
+{
+ first=first_target;
+ second=second_target;
 }
 
-void Sprite::draw_normal_sprite()
+bool Collision::check_horizontal_collision() const
 {
- unsigned long int x,y,index;
- x=0;
- y=0;
- for (index=sprite_width*sprite_height;index>0;--index)
+ bool result;
+ result=false;
+ if ((first.x+first.width)>=second.x)
  {
-  this->draw_image_pixel(this->get_offset(start,x,y),x+current_x,y+current_y);
-  ++x;
-  if (x==sprite_width)
-  {
-   x=0;
-   ++y;
-  }
+  if (first.x<=(second.x+second.width)) result=true;
+ }
+ return result;
+}
 
+bool Collision::check_vertical_collision() const
+{
+ bool result;
+ result=false;
+ if ((first.y+first.height)>=second.y)
+ {
+  if (first.y<=(second.y+second.height)) result=true;
  }
+ return result;
+}
 
+bool Collision::check_collision() const
+{
+ return this->check_horizontal_collision() && this->check_vertical_collision();
 }
 
-void Sprite::load_sprite(Image &buffer,const SPRITE_TYPE kind,const unsigned long int frames)
+bool Collision::check_mask_collision() const
 {
- this->load_image(buffer);
- if (kind!=SINGLE_SPRITE) this->set_frames(frames);
- this->set_kind(kind);
+ bool result;
+ unsigned long int left,top,right,bottom,x,y,amount;
+ result=false;
+ left=first.x;
+ top=first.y;
+ right=first.x+first.width;
+ bottom=first.y+first.height;
+ if (left<second.x) left=second.x;
+ if (top<second.y) top=second.y;
+ if (right>second.x+second.width) right=second.x+second.width;
+ if (bottom>second.y+second.height) bottom=second.y+second.height;
+ for (y=top;(y<bottom)&&(result==false);++y)
+ {
+  for (x=left;(x<right)&&(result==false);x+=amount)
+  {
+   amount=right-x;
+   if (amount>MASK_BITS) amount=MASK_BITS;
+   if ((this->get_mask_bits(first,x-first.x,y-first.y,amount)&this->get_mask_bits(second,x-second.x,y-second.y,amount))!=0)
+   {
+    result=true;
+   }
+
+  }
+
+ }
+ return result;
 }
 
-void Sprite::set_transparent(const bool enabled)
+bool Collision::check_horizontal_collision(const Collision_Box &first_target,const Collision_Box &second_target)
 {
- transparent=enabled;
+ this->set_target(first_target,second_target);
+ return this->check_horizontal_collision();
 }
 
-bool Sprite::get_transparent() const
+bool Collision::check_vertical_collision(const Collision_Box &first_target,const Collision_Box &second_target)
 {
- return transparent;
+ this->set_target(first_target,second_target);
+ return this->check_vertical_collision();
 }
 
-void Sprite::set_x(const unsigned long int x)
+bool Collision::check_collision(const Collision_Box &first_target,const Collision_Box &second_target)
 {
- current_x=x;
+ this->set_target(first_target,second_target);
+ return this->check_collision();
 }
 
-void Sprite::set_y(const unsigned long int y)
+bool Collision::check_mask_collision(const Collision_Box &first_target,const Collision_Box &second_target)
 {
- current_y=y;
+ this->set_target(first_target,second_target);
+ return this->check_mask_collision();
 }
 
-void Sprite::increase_x()
+Collision_Box Collision::generate_box(const unsigned long int x,const unsigned long int y,const unsigned long int width,const unsigned long int height) const
 {
- ++current_x;
+ Collision_Box result;
+ result.x=x;
+ result.y=y;
+ result.width=width;
+ result.height=height;
+ result.mask=NULL;
+ return result;
 }
 
-void Sprite::decrease_x()
+Asset_Loader::Asset_Loader()
 {
- --current_x;
+ run=false;
+ loader=0;
+ pthread_mutex_init(&lock,NULL);
+ pthread_cond_init(&signal,NULL);
+ pthread_cond_init(&finished,NULL);
+ jobs=NULL;
+ job_amount=0;
+ job_limit=0;
+ order=0;
+ io_time=0;
+ decode_time=0;
 }
 
-void Sprite::increase_y()
+Asset_Loader::~Asset_Loader()
 {
- ++current_y;
+ this->clear_jobs();
+ if (jobs!=NULL) free(jobs);
+ pthread_cond_destroy(&finished);
+ pthread_cond_destroy(&signal);
+ pthread_mutex_destroy(&lock);
 }
 
-void Sprite::decrease_y()
+unsigned long int Asset_Loader::get_time() const
 {
- --current_y;
+ struct timeval now;
+ gettimeofday(&now,NULL);
+ return static_cast<unsigned long int>(now.tv_sec)*1000000+static_cast<unsigned long int>(now.tv_usec);
 }
 
-void Sprite::increase_x(const unsigned long int increment)
+void Asset_Loader::start_loader()
 {
- current_x+=increment;
+ if (run==false)
+ {
+  run=true;
+  if (pthread_create(&loader,NULL,asset_loader_worker,this)!=0)
+  {
+   Halt("Can't start asset loader");
+  }
+
+ }
+
 }
 
-void Sprite::decrease_x(const unsigned long int decrement)
+void Asset_Loader::stop_loader()
 {
- current_x-=decrement;
+ size_t job;
+ if (run==true)
+ {
+  pthread_mutex_lock(&lock);
+  run=false;
+  for (job=0;job<job_amount;++job)
+  {
+   if (jobs[job].state==LOAD_WAITING) jobs[job].state=LOAD_CANCELED;
+  }
+  pthread_cond_signal(&signal);
+  pthread_cond_broadcast(&finished);
+  pthread_mutex_unlock(&lock);
+  pthread_join(loader,NULL);
+ }
+
 }
 
-void Sprite::increase_y(const unsigned long int increment)
+void Asset_Loader::check_handle(const size_t handle) const
 {
- current_y+=increment;
+ if (handle>=job_amount)
+ {
+  Halt("Invalid load handle");
+ }
+
 }
 
-void Sprite::decrease_y(const unsigned long int decrement)
+size_t Asset_Loader::add_job(const char *name,void *target,const unsigned char kind,const unsigned long int priority)
 {
- current_y-=decrement;
+ size_t handle;
+ LOAD_Job *resized;
+ char *copy;
+ copy=static_cast<char*>(malloc(strlen(name)+1));
+ if (copy==NULL)
+ {
+  Halt("Can't allocate memory for load queue");
+ }
+ strcpy(copy,name);
+ this->start_loader();
+ pthread_mutex_lock(&lock);
+ if (job_amount==job_limit)
+ {
+  resized=static_cast<LOAD_Job*>(realloc(jobs,(job_limit+8)*sizeof(LOAD_Job)));
+  if (resized==NULL)
+  {
+   Halt("Can't allocate memory for load queue");
+  }
+  jobs=resized;
+  job_limit+=8;
+ }
+ handle=job_amount;
+ jobs[handle].name=copy;
+ jobs[handle].target=target;
+ jobs[handle].priority=priority;
+ jobs[handle].order=order;
+ jobs[handle].io_time=0;
+ jobs[handle].decode_time=0;
+ jobs[handle].kind=kind;
+ jobs[handle].state=LOAD_WAITING;
+ ++job_amount;
+ ++order;
+ pthread_cond_signal(&signal);
+ pthread_mutex_unlock(&lock);
+ return handle;
+}
+
+size_t Asset_Loader::get_next_job() const
+{
+ size_t job,result;
+ result=LOAD_NONE;
+ for (job=0;job<job_amount;++job)
+ {
+  if (jobs[job].state==LOAD_WAITING)
+  {
+   if (result==LOAD_NONE)
+   {
+    result=job;
+   }
+   else
+   {
+    if ((jobs[job].priority>jobs[result].priority)||((jobs[job].priority==jobs[result].priority)&&(jobs[job].order<jobs[result].order))) result=job;
+   }
+
+  }
+
+ }
+ return result;
 }
 
-unsigned long int Sprite::get_x() const
+void Asset_Loader::run_job(LOAD_Job &target)
 {
- return current_x;
+ Input_File source;
+ Image *image;
+ unsigned long int start,loaded;
+ start=this->get_time();
+ if (target.kind==LOAD_WAVE)
+ {
+  static_cast<Audio*>(target.target)->load_wave(target.name);
+  loaded=this->get_time();
+ }
+ else
+ {
+  image=static_cast<Image*>(target.target);
+  source.open_mapped(target.name);
+  source.preload();
+  loaded=this->get_time();
+  if (target.kind==TGA_IMAGE)
+  {
+   image->load_tga(source);
+  }
+  else
+  {
+   image->load_pcx(source);
+  }
+  source.close();
+ }
+ target.io_time=loaded-start;
+ target.decode_time=this->get_time()-loaded;
 }
 
-unsigned long int Sprite::get_y() const
+size_t Asset_Loader::load_image(Image &target,const char *name,const IMAGE_TYPE kind,const unsigned long int priority)
 {
- return current_y;
+ return this->add_job(name,&target,static_cast<unsigned char>(kind),priority);
 }
 
-unsigned long int Sprite::get_width() const
+size_t Asset_Loader::load_audio(Audio &target,const char *name,const unsigned long int priority)
 {
- return sprite_width;
+ return this->add_job(name,&target,LOAD_WAVE,priority);
 }
 
-unsigned long int Sprite::get_height() const
+LOAD_STATE Asset_Loader::get_state(const size_t handle)
 {
- return sprite_height;
+ LOAD_STATE result;
+ pthread_mutex_lock(&lock);
+ this->check_handle(handle);
+ result=static_cast<LOAD_STATE>(jobs[handle].state);
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-Sprite* Sprite::get_handle()
+bool Asset_Loader::check_ready(const size_t handle)
 {
- return this;
+ return this->get_state(handle)==LOAD_READY;
 }
 
-Collision_Box Sprite::get_box() const
+void Asset_Loader::wait(const size_t handle)
 {
- Collision_Box target;
- target.x=current_x;
- target.y=current_y;
- target.width=sprite_width;
- target.height=sprite_height;
- return target;
+ pthread_mutex_lock(&lock);
+ this->check_handle(handle);
+ while ((jobs[handle].state==LOAD_WAITING)||(jobs[handle].state==LOAD_RUNNING))
+ {
+  pthread_cond_wait(&finished,&lock);
+ }
+ pthread_mutex_unlock(&lock);
 }
 
-void Sprite::set_kind(const SPRITE_TYPE kind)
+void Asset_Loader::wait_all()
 {
- switch(kind)
+ size_t job,amount;
+ pthread_mutex_lock(&lock);
+ amount=job_amount;
+ pthread_mutex_unlock(&lock);
+ for (job=0;job<amount;++job)
  {
-  case SINGLE_SPRITE:
-  sprite_width=this->get_image_width();
-  sprite_height=this->get_image_height();
-  start=0;
-  break;
-  case HORIZONTAL_STRIP:
-  sprite_width=this->get_image_width()/this->get_frames();
-  sprite_height=this->get_image_height();
-  start=(this->get_frame()-1)*sprite_width;
-  break;
-  case VERTICAL_STRIP:
-  sprite_width=this->get_image_width();
-  sprite_height=this->get_image_height()/this->get_frames();
-  start=(this->get_frame()-1)*sprite_width*sprite_height;
-  break;
+  this->wait(job);
  }
- current_kind=kind;
-}
 
-SPRITE_TYPE Sprite::get_kind() const
-{
- return current_kind;
 }
 
-void Sprite::set_target(const unsigned long int target)
+bool Asset_Loader::cancel(const size_t handle)
 {
- this->set_frame(target);
- this->set_kind(current_kind);
+ bool result;
+ result=false;
+ pthread_mutex_lock(&lock);
+ this->check_handle(handle);
+ if (jobs[handle].state==LOAD_WAITING)
+ {
+  jobs[handle].state=LOAD_CANCELED;
+  result=true;
+  pthread_cond_broadcast(&finished);
+ }
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-void Sprite::step()
+void Asset_Loader::set_priority(const size_t handle,const unsigned long int priority)
 {
- this->increase_frame();
- this->set_kind(current_kind);
+ pthread_mutex_lock(&lock);
+ this->check_handle(handle);
+ jobs[handle].priority=priority;
+ pthread_mutex_unlock(&lock);
 }
 
-void Sprite::set_position(const unsigned long int x,const unsigned long int y)
+size_t Asset_Loader::get_pending()
 {
- current_x=x;
- current_y=y;
+ size_t job,result;
+ result=0;
+ pthread_mutex_lock(&lock);
+ for (job=0;job<job_amount;++job)
+ {
+  if ((jobs[job].state==LOAD_WAITING)||(jobs[job].state==LOAD_RUNNING)) ++result;
+ }
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-void Sprite::clone(Sprite &target)
+unsigned long int Asset_Loader::get_io_time(const size_t handle)
 {
- this->set_width(target.get_image_width());
- this->set_height(target.get_image_height());
- this->set_frames(target.get_frames());
- this->set_kind(target.get_kind());
- this->set_transparent(target.get_transparent());
- this->set_buffer(this->create_buffer(target.get_image_width(),target.get_image_width()));
- memmove(this->get_image(),target.get_image(),target.get_length());
+ unsigned long int result;
+ pthread_mutex_lock(&lock);
+ this->check_handle(handle);
+ result=jobs[handle].io_time;
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-void Sprite::draw_sprite()
+unsigned long int Asset_Loader::get_decode_time(const size_t handle)
 {
- if (transparent==true)
- {
-  this->draw_transparent_sprite();
- }
- else
- {
-  this->draw_normal_sprite();
- }
-
+ unsigned long int result;
+ pthread_mutex_lock(&lock);
+ this->check_handle(handle);
+ result=jobs[handle].decode_time;
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-void Sprite::draw_sprite(const unsigned long int x,const unsigned long int y)
+unsigned long int Asset_Loader::get_total_io_time()
 {
- this->set_position(x,y);
- this->draw_sprite();
+ unsigned long int result;
+ pthread_mutex_lock(&lock);
+ result=io_time;
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-void Sprite::draw_sprite(const bool transparency)
+unsigned long int Asset_Loader::get_total_decode_time()
 {
- this->set_transparent(transparency);
- this->draw_sprite();
+ unsigned long int result;
+ pthread_mutex_lock(&lock);
+ result=decode_time;
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-void Sprite::draw_sprite(const bool transparency,const unsigned long int x,const unsigned long int y)
+void Asset_Loader::clear_jobs()
 {
- this->set_transparent(transparency);
- this->draw_sprite(x,y);
+ size_t job;
+ this->stop_loader();
+ for (job=0;job<job_amount;++job)
+ {
+  free(jobs[job].name);
+ }
+ job_amount=0;
+ order=0;
+ io_time=0;
+ decode_time=0;
 }
 
-Tileset::Tileset()
+void Asset_Loader::stop()
 {
- offset=0;
- rows=0;
- columns=0;
- tile_width=0;
- tile_height=0;
+ this->stop_loader();
 }
 
-Tileset::~Tileset()
+void Asset_Loader::load_assets()
 {
+ size_t job;
+ LOAD_Job current;
+ pthread_mutex_lock(&lock);
+ while (run==true)
+ {
+  job=this->get_next_job();
+  if (job==LOAD_NONE)
+  {
+   pthread_cond_wait(&signal,&lock);
+  }
+  else
+  {
+   jobs[job].state=LOAD_RUNNING;
+   current=jobs[job];
+   pthread_mutex_unlock(&lock);
+   this->run_job(current);
+   pthread_mutex_lock(&lock);
+   jobs[job].io_time=current.io_time;
+   jobs[job].decode_time=current.decode_time;
+   jobs[job].state=LOAD_READY;
+   io_time+=current.io_time;
+   decode_time+=current.decode_time;
+   pthread_cond_broadcast(&finished);
+  }
 
+ }
+ pthread_mutex_unlock(&lock);
 }
 
-unsigned long int Tileset::get_tile_width() const
-{
- return tile_width;
-}
-
-unsigned long int Tileset::get_tile_height() const
+Asset_Loader* Asset_Loader::get_handle()
 {
- return tile_height;
+ return this;
 }
 
-unsigned long int Tileset::get_rows() const
+Asset_Cache::Asset_Cache()
 {
- return rows;
+ pthread_mutex_init(&lock,NULL);
+ pthread_cond_init(&loaded,NULL);
+ entries=NULL;
+ entry_amount=0;
+ entry_limit=0;
+ budget=CACHE_BUDGET;
+ resident=0;
+ free_limit=0;
+ stamp=0;
+ hits=0;
+ misses=0;
+ evictions=0;
 }
 
-unsigned long int Tileset::get_columns() const
+Asset_Cache::~Asset_Cache()
 {
- return columns;
+ while (entry_amount>0)
+ {
+  this->remove_entry(entry_amount-1);
+ }
+ if (entries!=NULL) free(entries);
+ pthread_cond_destroy(&loaded);
+ pthread_mutex_destroy(&lock);
 }
 
-void Tileset::select_tile(const unsigned long int row,const unsigned long int column)
+Image *Asset_Cache::create_image()
 {
- if ((row<rows)&&(column<columns))
+ Image *target;
+ target=NULL;
+ try
  {
-  offset=this->get_offset(0,row*tile_width,column*tile_height);
+  target=new Image;
  }
-
+ catch (...)
+ {
+  Halt("Can't allocate memory for asset cache");
+ }
+ target->set_shared(true);
+ target->set_cache(this);
+ return target;
 }
 
-void Tileset::draw_tile(const unsigned long int x,const unsigned long int y)
+size_t Asset_Cache::find_entry(const char *name,const unsigned char kind) const
 {
- unsigned long int tile_x,tile_y,index;
- tile_x=0;
- tile_y=0;
- for (index=tile_width*tile_height;index>0;--index)
+ size_t entry,result;
+ result=CACHE_NONE;
+ for (entry=0;entry<entry_amount;++entry)
  {
-  this->draw_image_pixel(offset+this->get_offset(0,tile_x,tile_y),x+tile_x,y+tile_y);
-  ++tile_x;
-  if (tile_x==tile_width)
+  if ((entries[entry].kind==kind)&&(strcmp(entries[entry].name,name)==0))
   {
-   tile_x=0;
-   ++tile_y;
+   result=entry;
+   break;
   }
 
  }
-
+ return result;
 }
 
-void Tileset::draw_tile(const unsigned long int row,const unsigned long int column,const unsigned long int x,const unsigned long int y)
+size_t Asset_Cache::find_image(const Image *target) const
 {
- this->select_tile(row,column);
- this->draw_tile(x,y);
+ size_t entry,result;
+ result=CACHE_NONE;
+ for (entry=0;entry<entry_amount;++entry)
+ {
+  if (entries[entry].image==target)
+  {
+   result=entry;
+   break;
+  }
+
+ }
+ return result;
 }
 
-void Tileset::load_tileset(Image &buffer,const unsigned long int row_amount,const unsigned long int column_amount)
+size_t Asset_Cache::add_entry(const char *name,const unsigned char kind)
 {
- if ((row_amount>0)&&(column_amount>0))
+ size_t entry;
+ CACHE_Entry *resized;
+ if (entry_amount==entry_limit)
  {
-  this->load_from_buffer(buffer);
-  rows=row_amount;
-  columns=column_amount;
-  tile_width=this->get_image_width()/rows;
-  tile_height=this->get_image_height()/columns;
+  resized=static_cast<CACHE_Entry*>(realloc(entries,(entry_limit+8)*sizeof(CACHE_Entry)));
+  if (resized==NULL)
+  {
+   Halt("Can't allocate memory for asset cache");
+  }
+  entries=resized;
+  entry_limit+=8;
  }
-
+ entry=entry_amount;
+ entries[entry].name=static_cast<char*>(malloc(strlen(name)+1));
+ if (entries[entry].name==NULL)
+ {
+  Halt("Can't allocate memory for asset cache");
+ }
+ strcpy(entries[entry].name,name);
+ entries[entry].image=this->create_image();
+ entries[entry].length=0;
+ entries[entry].references=1;
+ entries[entry].stamp=stamp;
+ entries[entry].kind=kind;
+ entries[entry].ready=false;
+ ++entry_amount;
+ return entry;
 }
 
-Text::Text()
+void Asset_Cache::remove_entry(const size_t entry)
 {
- current_x=0;
- current_y=0;
- font=NULL;
+ resident-=entries[entry].length;
+ delete entries[entry].image;
+ free(entries[entry].name);
+ --entry_amount;
+ entries[entry]=entries[entry_amount];
 }
 
-Text::~Text()
+bool Asset_Cache::check_pressure()
 {
-
+ bool result;
+ result=false;
+ if ((budget>0)&&(resident>budget))
+ {
+  result=true;
+ }
+ if ((result==false)&&(free_limit>0))
+ {
+  result=(memory.get_free_memory()<free_limit);
+ }
+ return result;
 }
 
-void Text::increase_position()
+size_t Asset_Cache::get_victim() const
 {
- font->increase_x(font->get_width());
-}
+ size_t entry,result;
+ result=CACHE_NONE;
+ for (entry=0;entry<entry_amount;++entry)
+ {
+  if ((entries[entry].references==0)&&(entries[entry].ready==true))
+  {
+   if ((result==CACHE_NONE)||(entries[entry].stamp<entries[result].stamp)) result=entry;
+  }
 
-void Text::restore_position()
-{
- font->set_position(current_x,current_y);
+ }
+ return result;
 }
 
-void Text::set_position(const unsigned long int x,const unsigned long int y)
+void Asset_Cache::evict_entries()
 {
- font->set_position(x,y);
- current_x=x;
- current_y=y;
+ size_t victim;
+ while (this->check_pressure()==true)
+ {
+  victim=this->get_victim();
+  if (victim==CACHE_NONE) break;
+  this->remove_entry(victim);
+  ++evictions;
+ }
+
 }
 
-void Text::load_font(Sprite *target)
+Image *Asset_Cache::acquire_image(const char *name,const IMAGE_TYPE kind)
 {
- font=target;
- font->set_frames(128);
- font->set_kind(HORIZONTAL_STRIP);
+ size_t entry;
+ Image *result;
+ pthread_mutex_lock(&lock);
+ entry=this->find_entry(name,kind);
+ if (entry==CACHE_NONE)
+ {
+  ++misses;
+  entry=this->add_entry(name,kind);
+  result=entries[entry].image;
+  pthread_mutex_unlock(&lock);
+  if (kind==TGA_IMAGE)
+  {
+   result->load_tga(name);
+  }
+  else
+  {
+   result->load_pcx(name);
+  }
+  pthread_mutex_lock(&lock);
+  entry=this->find_image(result);
+  entries[entry].length=result->get_length();
+  entries[entry].ready=true;
+  resident+=entries[entry].length;
+  pthread_cond_broadcast(&loaded);
+ }
+ else
+ {
+  ++hits;
+  ++entries[entry].references;
+  while (entries[entry].ready==false)
+  {
+   pthread_cond_wait(&loaded,&lock);
+   entry=this->find_entry(name,kind);
+  }
+  result=entries[entry].image;
+ }
+ entries[entry].stamp=stamp;
+ ++stamp;
+ this->evict_entries();
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-void Text::draw_character(const char target)
+void Asset_Cache::retain_image(Image *target)
 {
- font->set_target(static_cast<unsigned char>(target)+1);
- font->draw_sprite();
+ size_t entry;
+ pthread_mutex_lock(&lock);
+ entry=this->find_image(target);
+ if (entry==CACHE_NONE)
+ {
+  Halt("Invalid cached image");
+ }
+ ++entries[entry].references;
+ pthread_mutex_unlock(&lock);
 }
 
-void Text::draw_text(const char *text)
+void Asset_Cache::release_image(Image *target)
 {
- size_t index,length;
- length=strlen(text);
- this->restore_position();
- for (index=0;index<length;++index)
+ size_t entry;
+ pthread_mutex_lock(&lock);
+ entry=this->find_image(target);
+ if (entry==CACHE_NONE)
  {
-  if (text[index]<32) continue;
-  this->draw_character(text[index]);
-  this->increase_position();
+  Halt("Invalid cached image");
  }
- this->restore_position();
+ if (entries[entry].references>0) --entries[entry].references;
+ this->evict_entries();
+ pthread_mutex_unlock(&lock);
 }
 
-void Text::draw_character(const unsigned long int x,const unsigned long int y,const char target)
+void Asset_Cache::set_budget(const size_t bytes)
 {
- this->set_position(x,y);
- this->draw_character(target);
+ pthread_mutex_lock(&lock);
+ budget=bytes;
+ this->evict_entries();
+ pthread_mutex_unlock(&lock);
 }
 
-void Text::draw_text(const unsigned long int x,const unsigned long int y,const char *text)
+size_t Asset_Cache::get_budget() const
 {
- this->set_position(x,y);
- this->draw_text(text);
+ return budget;
 }
 
-Collision::Collision()
+void Asset_Cache::set_free_limit(const unsigned long int bytes)
 {
- first.x=0;
- first.y=0;
- first.width=0;
- first.height=0;
- second.x=0;
- second.y=0;
- second.width=0;
- second.height=0;
+ pthread_mutex_lock(&lock);
+ free_limit=bytes;
+ this->evict_entries();
+ pthread_mutex_unlock(&lock);
 }
 
-Collision::~Collision()
+unsigned long int Asset_Cache::get_free_limit() const
 {
-
+ return free_limit;
 }
 
-void Collision::set_target(const Collision_Box &first_target,const Collision_Box &second_target)
+void Asset_Cache::trim()
 {
- first=first_target;
- second=second_target;
+ pthread_mutex_lock(&lock);
+ this->evict_entries();
+ pthread_mutex_unlock(&lock);
 }
 
-bool Collision::check_horizontal_collision() const
+void Asset_Cache::clear()
 {
- bool result;
- result=false;
- if ((first.x+first.width)>=second.x)
+ size_t victim;
+ pthread_mutex_lock(&lock);
+ for (victim=this->get_victim();victim!=CACHE_NONE;victim=this->get_victim())
  {
-  if (first.x<=(second.x+second.width)) result=true;
+  this->remove_entry(victim);
+  ++evictions;
  }
- return result;
+ pthread_mutex_unlock(&lock);
 }
 
-bool Collision::check_vertical_collision() const
+size_t Asset_Cache::get_entries()
 {
- bool result;
- result=false;
- if ((first.y+first.height)>=second.y)
- {
-  if (first.y<=(second.y+second.height)) result=true;
- }
+ size_t result;
+ pthread_mutex_lock(&lock);
+ result=entry_amount;
+ pthread_mutex_unlock(&lock);
  return result;
 }
 
-bool Collision::check_collision() const
+size_t Asset_Cache::get_resident()
 {
- return this->check_horizontal_collision() || this->check_vertical_collision();
+ size_t result;
+ pthread_mutex_lock(&lock);
+ result=resident;
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-bool Collision::check_horizontal_collision(const Collision_Box &first_target,const Collision_Box &second_target)
+unsigned long int Asset_Cache::get_hits()
 {
- this->set_target(first_target,second_target);
- return this->check_horizontal_collision();
+ unsigned long int result;
+ pthread_mutex_lock(&lock);
+ result=hits;
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-bool Collision::check_vertical_collision(const Collision_Box &first_target,const Collision_Box &second_target)
+unsigned long int Asset_Cache::get_misses()
 {
- this->set_target(first_target,second_target);
- return this->check_vertical_collision();
+ unsigned long int result;
+ pthread_mutex_lock(&lock);
+ result=misses;
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-bool Collision::check_collision(const Collision_Box &first_target,const Collision_Box &second_target)
+unsigned long int Asset_Cache::get_evictions()
 {
- this->set_target(first_target,second_target);
- return this->check_collision();
+ unsigned long int result;
+ pthread_mutex_lock(&lock);
+ result=evictions;
+ pthread_mutex_unlock(&lock);
+ return result;
 }
 
-Collision_Box Collision::generate_box(const unsigned long int x,const unsigned long int y,const unsigned long int width,const unsigned long int height) const
+Asset_Cache* Asset_Cache::get_handle()
 {
- Collision_Box result;
- result.x=x;
- result.y=y;
- result.width=width;
- result.height=height;
- return result;
+ return this;
 }
 
 }
\ No newline at end of file
@@ -34,16 +34,37 @@ SVGALib homepage: http://www.svgalib.org/
 #include <new>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <sys/sysinfo.h>
 #include <sys/ioctl.h>
 #include <sys/soundcard.h>
 #include <linux/input.h>
 #include <linux/fb.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)||defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 
 enum GAMEPAD_BUTTONS {BUTTON_UP=0,BUTTON_DOWN=1,BUTTON_LEFT=2,BUTTON_RIGHT=3,BUTTON_A=4,BUTTON_B=5,BUTTON_C=6,BUTTON_X=7,BUTTON_Y=8,BUTTON_Z=9,BUTTON_R=10,BUTTON_L=11,BUTTON_START=12,BUTTON_MENU=13,BUTTON_POWER=14,BUTTON_HOLD=15};
 enum MIRROR_TYPE {MIRROR_HORIZONTAL=0,MIRROR_VERTICAL=1};
 enum BACKGROUND_TYPE {NORMAL_BACKGROUND=0,HORIZONTAL_BACKGROUND=1,VERTICAL_BACKGROUND=2};
 enum SPRITE_TYPE {SINGLE_SPRITE=0,HORIZONTAL_STRIP=1,VERTICAL_STRIP=2};
+enum IMAGE_TYPE {TGA_IMAGE=0,PCX_IMAGE=1};
+enum LOAD_STATE {LOAD_WAITING=0,LOAD_RUNNING=1,LOAD_READY=2,LOAD_CANCELED=3};
+
+namespace DINGUXGDK
+{
+ class Image;
+ class Audio;
+ class Asset_Cache;
+}
 
 struct WAVE_head
 {
@@ -94,6 +115,27 @@ struct TGA_image
  unsigned char direction:5;
 };
 
+struct TGA_Cursor
+{
+ unsigned long int position:32;
+ unsigned long int skip:32;
+};
+
+struct TGA_format
+{
+ size_t palette;
+ size_t position;
+ size_t size;
+ size_t depth;
+ size_t first;
+ size_t colors;
+ unsigned long int width;
+ unsigned long int height;
+ unsigned char descriptor;
+ bool mapped;
+ bool compressed;
+};
+
 struct PCX_head
 {
  unsigned char vendor:8;
@@ -116,19 +158,214 @@ struct PCX_head
  unsigned char filled[54];
 };
 
+struct IMG_Span
+{
+ unsigned long int start:32;
+ unsigned long int length:32;
+};
+
+struct BG_Frame
+{
+ unsigned short int *pixels;
+ unsigned long int frame:32;
+ unsigned long int stamp:32;
+};
+
+struct MAP_Chunk
+{
+ unsigned short int *pixels;
+ unsigned long int stamp:32;
+ bool dirty;
+};
+
+struct TILE_Frame
+{
+ unsigned long int row:32;
+ unsigned long int column:32;
+ unsigned long int duration:32;
+};
+
+struct TILE_Animation
+{
+ unsigned short int *sequence;
+ unsigned long int *durations;
+ size_t amount;
+ unsigned long int period:32;
+ unsigned short int tile:16;
+ unsigned long int stamp:32;
+};
+
+struct MAP_head
+{
+ char signature[4];
+ unsigned long int width:32;
+ unsigned long int height:32;
+ unsigned short int chunk_width:16;
+ unsigned short int chunk_height:16;
+ unsigned short int layers:16;
+ unsigned short int flags:16;
+};
+
+struct AST_head
+{
+ char signature[4];
+ unsigned long int width:32;
+ unsigned long int height:32;
+ unsigned long int frames:32;
+ unsigned long int pixels:32;
+ unsigned long int rows:32;
+ unsigned long int spans:32;
+ unsigned long int span_amount:32;
+ unsigned long int masks:32;
+ unsigned short int key:16;
+ unsigned char format:8;
+ unsigned char kind:8;
+ unsigned short int mask_bits:16;
+ unsigned short int flags:16;
+};
+
+struct MAP_Entry
+{
+ unsigned long int offset:32;
+ unsigned long int length:32;
+};
+
+struct MAP_Slot
+{
+ unsigned short int *tiles;
+ unsigned char *collision;
+ unsigned long int chunk:32;
+ unsigned long int stamp:32;
+ unsigned long int distance:32;
+ unsigned char state:8;
+ bool ready;
+};
+
+struct FNT_Span
+{
+ unsigned short int x:16;
+ unsigned short int y:16;
+ unsigned short int length:16;
+ unsigned long int offset:32;
+};
+
+struct FNT_Glyph
+{
+ unsigned long int first:32;
+ unsigned long int amount:32;
+ unsigned short int left:16;
+ unsigned short int width:16;
+};
+
+struct PRM_Point
+{
+ long int x:32;
+ long int y:32;
+};
+
+struct PRM_Rectangle
+{
+ long int x:32;
+ long int y:32;
+ unsigned long int width:32;
+ unsigned long int height:32;
+};
+
+struct PRM_Edge
+{
+ long int x:32;
+ long int step:32;
+ long int error:32;
+ long int delta_x:32;
+ long int delta_y:32;
+ long int top:32;
+ long int bottom:32;
+};
+
 struct Collision_Box
 {
  unsigned long int x:32;
  unsigned long int y:32;
  unsigned long int width:32;
  unsigned long int height:32;
+ const unsigned long int *mask;
+};
+
+struct PAK_head
+{
+ char signature[4];
+ unsigned long int amount:32;
+ unsigned long int flags:32;
+ unsigned long int reserved:32;
+};
+
+struct PAK_Entry
+{
+ char name[48];
+ unsigned long int offset:32;
+ unsigned long int length:32;
+ unsigned long int size:32;
+ unsigned long int flags:32;
+};
+
+struct SHEET_Frame
+{
+ unsigned long int serial:32;
+ unsigned long int stamp:32;
+ unsigned long int references:32;
+};
+
+struct CACHE_Entry
+{
+ char *name;
+ DINGUXGDK::Image *image;
+ size_t length;
+ unsigned long int references:32;
+ unsigned long int stamp:32;
+ unsigned char kind:8;
+ bool ready;
+};
+
+struct MIX_Voice
+{
+ DINGUXGDK::Audio *audio;
+ size_t position;
+ size_t length;
+ unsigned long int priority:32;
+ unsigned long int stamp:32;
+ unsigned long int step:32;
+ unsigned long int fraction:32;
+ unsigned short int channels:16;
+ unsigned short int volume:16;
+ short int pan:16;
+ bool loop;
+ bool active;
+};
+
+struct LOAD_Job
+{
+ char *name;
+ void *target;
+ unsigned long int priority:32;
+ unsigned long int order:32;
+ unsigned long int io_time:32;
+ unsigned long int decode_time:32;
+ unsigned char kind:8;
+ unsigned char state:8;
 };
 
 namespace DINGUXGDK
 {
 
-void* oss_play_sound(void *buffer);
+void* sound_stream_worker(void *target);
+void* map_stream_worker(void *target);
+void* asset_loader_worker(void *target);
+void* music_stream_worker(void *target);
+size_t load_counter(const volatile size_t &counter);
+void store_counter(volatile size_t &counter,const size_t value);
 void Halt(const char *message);
+unsigned short int pack_pixel(const unsigned short int red,const unsigned short int green,const unsigned short int blue);
+size_t format_number(char *target,const unsigned long int value,const size_t digits);
 
 class Frame
 {
@@ -157,6 +394,7 @@ class Frame
  unsigned long int get_frame_width() const;
  unsigned long int get_frame_height() const;
  bool draw_pixel(const unsigned long int x,const unsigned long int y,const unsigned short int red,const unsigned short int green,const unsigned short int blue);
+ bool draw_pixel(const unsigned long int x,const unsigned long int y,const unsigned short int color);
  void clear_screen();
  void save();
  void restore();
@@ -279,24 +517,56 @@ class Memory
 class Sound
 {
  private:
- char *internal;
+ int device;
+ int rate;
+ bool run;
+ int policy;
+ int priority;
+ char *ring;
+ size_t *lengths;
  size_t buffer_length;
+ size_t periods;
+ volatile size_t head;
+ volatile size_t tail;
+ volatile size_t underruns;
+ unsigned long int overruns;
  pthread_t stream;
+ pthread_mutex_t lock;
+ pthread_cond_t signal;
+ pthread_cond_t finished;
  void open_device();
  void set_format();
  void set_channels();
- void set_rate(const int rate);
+ void set_rate(const int target);
  void get_buffer_length();
  void configure_sound_card(const int rate);
  void start_stream();
+ void stop_stream();
+ void apply_scheduling();
+ size_t get_distance(const size_t first,const size_t second) const;
+ size_t get_next(const size_t counter) const;
+ void write_device(const char *buffer,const size_t length);
  void create_buffer();
  public:
  Sound();
  ~Sound();
+ void set_periods(const size_t amount);
+ size_t get_periods() const;
+ void set_scheduling(const int target_policy,const int target_priority);
+ int get_policy() const;
+ int get_priority() const;
  void initialize(const int rate);
+ int get_rate() const;
  bool check_busy();
+ void wait();
  size_t get_length() const;
+ size_t get_fill() const;
+ unsigned long int get_underruns() const;
+ unsigned long int get_overruns() const;
+ char *acquire_period();
+ void release_period(const size_t length);
  size_t send(char *buffer,const size_t length);
+ void play_sound();
  Sound* get_handle();
 };
 
@@ -392,11 +662,28 @@ class Binary_File
 
 class Input_File:public Binary_File
 {
+ private:
+ unsigned char *mapping;
+ size_t mapping_length;
+ size_t mapping_position;
+ bool mapping_heap;
+ bool mapping_view;
+ void clear_mapping();
  public:
  Input_File();
  ~Input_File();
  void open(const char *name);
+ void open_mapped(const char *name);
+ void open_memory(unsigned char *data,const size_t length,const bool owned);
+ void close();
  void read(void *buffer,const size_t length);
+ void set_position(const long int offset);
+ long int get_position();
+ long int get_length();
+ bool check_error();
+ bool check_mapped() const;
+ const unsigned char *get_view(const size_t offset,const size_t length) const;
+ void preload();
 };
 
 class Output_File:public Binary_File
@@ -410,6 +697,53 @@ class Output_File:public Binary_File
  void flush();
 };
 
+class Pack_File
+{
+ private:
+ Input_File pack;
+ const PAK_Entry *index;
+ size_t amount;
+ size_t find_entry(const char *name) const;
+ size_t read_length(const unsigned char *&source,const unsigned char *stop) const;
+ unsigned char *decompress_entry(const PAK_Entry &entry) const;
+ public:
+ Pack_File();
+ ~Pack_File();
+ void open(const char *name);
+ void close();
+ size_t get_amount() const;
+ const char *get_name(const size_t entry) const;
+ size_t get_size(const size_t entry) const;
+ bool check_compressed(const size_t entry) const;
+ bool check_entry(const char *name) const;
+ void open_entry(const char *name,Input_File &target);
+ Pack_File* get_handle();
+};
+
+class Pack_Writer
+{
+ private:
+ Output_File target;
+ PAK_Entry *entries;
+ char **paths;
+ size_t amount;
+ size_t limit;
+ size_t position;
+ void clear_entries();
+ void sort_entries();
+ unsigned char *read_source(const char *path,size_t &length);
+ size_t write_length(unsigned char *output,size_t length) const;
+ size_t write_sequence(unsigned char *output,const unsigned char *literals,const size_t literal_length,const size_t offset,const size_t match) const;
+ size_t compress_data(const unsigned char *source,const size_t length,unsigned char *output) const;
+ void write_padding();
+ public:
+ Pack_Writer();
+ ~Pack_Writer();
+ void create(const char *name);
+ void add_file(const char *name,const char *path,const bool compress);
+ void close();
+};
+
 class Audio
 {
  private:
@@ -432,7 +766,10 @@ class Audio
  unsigned short int get_channels() const;
  unsigned short int get_bits() const;
  void load_wave(const char *name);
+ void load_wave(Pack_File &pack,const char *name);
  void read_data(void *buffer,const size_t length);
+ void read_data(void *buffer,const size_t offset,const size_t length);
+ const unsigned char *get_view(const size_t offset,const size_t length) const;
  void go_start();
 };
 
@@ -441,12 +778,9 @@ class Player
  private:
  Sound *sound;
  Audio *target;
- char *buffer;
  size_t index;
  size_t length;
  void configure_player(Audio *audio);
- void clear_buffer();
- void create_buffer();
  public:
  Player();
  ~Player();
@@ -458,19 +792,160 @@ class Player
  void loop();
 };
 
+class Music_Stream
+{
+ private:
+ Audio audio;
+ Sound *sound;
+ bool run;
+ bool looping;
+ bool finished;
+ pthread_t stream;
+ pthread_mutex_t lock;
+ pthread_cond_t signal;
+ char *ring;
+ size_t *lengths;
+ size_t periods;
+ size_t period_length;
+ size_t frame_length;
+ volatile size_t head;
+ volatile size_t tail;
+ size_t offset;
+ size_t position;
+ size_t total;
+ size_t loop_start;
+ size_t loop_end;
+ unsigned long int underruns;
+ size_t get_distance(const size_t first,const size_t second) const;
+ size_t get_next(const size_t counter) const;
+ void get_loop(size_t &start,size_t &end) const;
+ void create_buffer();
+ void clear_buffer();
+ void configure_stream();
+ void start_stream();
+ void stop_stream();
+ bool fill_period(const size_t start,const size_t end,const bool loop);
+ void copy_frames(short int *target,const char *source,const size_t amount) const;
+ void check_rate() const;
+ public:
+ Music_Stream();
+ ~Music_Stream();
+ void set_prefetch(const size_t amount);
+ size_t get_prefetch() const;
+ void open(const char *name);
+ void open(Pack_File &pack,const char *name);
+ void close();
+ void set_loop(const size_t start,const size_t end);
+ size_t get_loop_start() const;
+ size_t get_loop_end() const;
+ void set_looping(const bool enabled);
+ bool get_looping() const;
+ unsigned long int get_rate() const;
+ size_t get_length() const;
+ size_t get_fill() const;
+ unsigned long int get_underruns() const;
+ bool is_end();
+ size_t read(short int *target,const size_t amount);
+ void initialize(Sound *target);
+ void update();
+ void prefetch_audio();
+ Music_Stream* get_handle();
+};
+
+class Sound_Mixer
+{
+ private:
+ Sound *sound;
+ Music_Stream *music;
+ MIX_Voice *voices;
+ int *accumulator;
+ short int *samples;
+ short int *input;
+ size_t voice_amount;
+ size_t frames;
+ unsigned long int stamp;
+ unsigned short int master;
+ unsigned short int music_volume;
+ void create_buffers();
+ void check_voice(const size_t voice) const;
+ size_t get_free_voice(const unsigned long int priority) const;
+ void read_frames(MIX_Voice &target,short int *buffer,const size_t position,const size_t amount);
+ size_t load_window(MIX_Voice &target);
+ size_t read_direct(MIX_Voice &target);
+ size_t read_converted(MIX_Voice &target);
+ size_t read_voice(MIX_Voice &target);
+ void add_samples(const size_t amount);
+ void scale_samples(const int left,const int right,const size_t amount);
+ void mix_voice(const unsigned short int volume,const short int pan,const size_t amount);
+ void store_samples(short int *target);
+ void check_music() const;
+ void mix_period(short int *target);
+ public:
+ Sound_Mixer();
+ ~Sound_Mixer();
+ void set_voices(const size_t amount);
+ size_t get_voices() const;
+ void initialize(Sound *target);
+ size_t play(Audio &audio,const unsigned long int priority,const bool loop);
+ void stop(const size_t voice);
+ void stop_all();
+ bool check_playing(const size_t voice) const;
+ void set_volume(const size_t voice,const unsigned short int level);
+ void set_pan(const size_t voice,const short int position);
+ void set_master_volume(const unsigned short int level);
+ unsigned short int get_master_volume() const;
+ void set_music(Music_Stream *target);
+ void set_music_volume(const unsigned short int level);
+ unsigned short int get_music_volume() const;
+ size_t get_active() const;
+ void update();
+ Sound_Mixer* get_handle();
+};
+
 class Primitive
 {
  private:
- IMG_Pixel color;
+ unsigned short int color;
  Screen *surface;
+ unsigned short int *buffer;
+ long int frame_width;
+ long int frame_height;
+ bool batch;
+ PRM_Edge *edges;
+ size_t edge_amount;
+ void prepare_surface();
+ void draw_pixel(const long int x,const long int y);
+ void draw_span(const long int x1,const long int x2,const long int y);
+ void draw_vertical_span(const long int x,const long int y1,const long int y2);
+ void draw_segment(const long int x1,const long int y1,const long int x2,const long int y2);
+ void fill_rectangle(const long int x,const long int y,const unsigned long int width,const unsigned long int height);
+ void draw_circle_points(const long int x,const long int y,const long int shift_x,const long int shift_y);
+ void fill_circle(const long int x,const long int y,const long int radius);
+ void trace_ellipse(const long int x,const long int y,const long int radius_x,const long int radius_y,const bool filled);
+ void create_edges(const size_t amount);
+ void fill_polygon(const PRM_Point *points,const size_t amount);
  public:
  Primitive();
  ~Primitive();
  void initialize(Screen *screen);
  void set_color(const unsigned char red,const unsigned char green,const unsigned char blue);
+ void begin_batch();
+ void end_batch();
  void draw_line(const unsigned long int x1,const unsigned long int y1,const unsigned long int x2,const unsigned long int y2);
  void draw_rectangle(const unsigned long int x,const unsigned long int y,const unsigned long int width,const unsigned long int height);
  void draw_filled_rectangle(const unsigned long int x,const unsigned long int y,const unsigned long int width,const unsigned long int height);
+ void draw_circle(const unsigned long int x,const unsigned long int y,const unsigned long int radius);
+ void draw_filled_circle(const unsigned long int x,const unsigned long int y,const unsigned long int radius);
+ void draw_ellipse(const unsigned long int x,const unsigned long int y,const unsigned long int radius_x,const unsigned long int radius_y);
+ void draw_filled_ellipse(const unsigned long int x,const unsigned long int y,const unsigned long int radius_x,const unsigned long int radius_y);
+ void draw_triangle(const unsigned long int x1,const unsigned long int y1,const unsigned long int x2,const unsigned long int y2,const unsigned long int x3,const unsigned long int y3);
+ void draw_filled_triangle(const unsigned long int x1,const unsigned long int y1,const unsigned long int x2,const unsigned long int y2,const unsigned long int x3,const unsigned long int y3);
+ void draw_polygon(const PRM_Point *points,const size_t amount);
+ void draw_filled_polygon(const PRM_Point *points,const size_t amount);
+ void draw_points(const PRM_Point *points,const size_t amount);
+ void draw_lines(const PRM_Point *points,const size_t amount);
+ void draw_filled_rectangles(const PRM_Rectangle *rectangles,const size_t amount);
+ void draw_filled_circles(const PRM_Point *centers,const size_t amount,const unsigned long int radius);
 };
 
 class Image
@@ -479,48 +954,154 @@ class Image
  unsigned long int width;
  unsigned long int height;
  unsigned char *data;
+ bool transfer;
+ bool packed;
+ bool shared;
+ Asset_Cache *cache;
  unsigned char *create_buffer(const size_t length);
  void clear_buffer();
+ size_t get_pixel_size() const;
+ IMG_Pixel read_tga_color(const unsigned char *source,const size_t size) const;
+ void expand_run(unsigned char *target,const size_t size,const size_t amount);
+ void store_pixel(const size_t index,const IMG_Pixel &pixel);
+ void read_tga_format(const unsigned char *source,const size_t length,TGA_format &format) const;
+ IMG_Pixel *read_tga_palette(const unsigned char *source,const TGA_format &format);
+ void decode_tga_pixels(const unsigned char *source,const size_t length,TGA_Cursor &cursor,unsigned char *target,const size_t amount,const size_t size);
+ const unsigned char *read_tga_line(const unsigned char *source,const size_t length,TGA_Cursor &cursor,unsigned char *decoded,const TGA_format &format);
+ void store_tga_line(const unsigned char *line,const unsigned long int row,const TGA_format &format,const IMG_Pixel *palette);
  public:
  Image();
  ~Image();
+ void load_tga(Input_File &target);
+ void load_tga(Input_File &target,const TGA_Cursor *rows,const unsigned long int region_width,const unsigned long int region_height);
+ TGA_Cursor *index_tga(Input_File &target,const unsigned long int columns,unsigned long int &image_width,unsigned long int &image_height);
+ void load_pcx(Input_File &target);
  void load_tga(const char *name);
  void load_pcx(const char *name);
  unsigned long int get_width() const;
  unsigned long int get_height() const;
  size_t get_length() const;
  unsigned char *get_data();
+ void set_transfer(const bool enabled);
+ bool get_transfer() const;
+ void set_packed(const bool enabled);
+ bool get_packed() const;
+ void set_shared(const bool enabled);
+ bool get_shared() const;
+ void set_cache(Asset_Cache *target);
+ Asset_Cache *get_cache() const;
+ unsigned char *release_data();
  void destroy_image();
 };
 
+class Sprite_Sheet
+{
+ private:
+ Input_File source;
+ Image *images;
+ SHEET_Frame *frames;
+ TGA_Cursor *index;
+ TGA_Cursor *rows;
+ IMG_Pixel key;
+ SPRITE_TYPE kind;
+ unsigned long int amount;
+ unsigned long int columns;
+ unsigned long int frame_width;
+ unsigned long int frame_height;
+ unsigned long int prefetch;
+ unsigned long int stamp;
+ unsigned long int serial;
+ unsigned long int hits;
+ unsigned long int misses;
+ size_t limit;
+ size_t resident;
+ void clear_sheet();
+ void create_frames();
+ void index_sheet(const SPRITE_TYPE target,const unsigned long int frames);
+ void check_frame(const unsigned long int target) const;
+ void evict_frames(const size_t keep);
+ void decode_frame(const unsigned long int target);
+ void prefetch_frames(const unsigned long int target,const unsigned long int count);
+ public:
+ Sprite_Sheet();
+ ~Sprite_Sheet();
+ void load_tga(const char *name,const SPRITE_TYPE target,const unsigned long int frames);
+ void load_tga(Pack_File &pack,const char *name,const SPRITE_TYPE target,const unsigned long int frames);
+ void set_cache_limit(const size_t frames);
+ size_t get_cache_limit() const;
+ void set_prefetch(const unsigned long int frames);
+ unsigned long int get_prefetch() const;
+ void prefetch_frames(const unsigned long int target);
+ Image *get_frame(const unsigned long int target,unsigned long int &frame_serial);
+ void retain_frame(const unsigned long int target);
+ void release_frame(const unsigned long int target);
+ SPRITE_TYPE get_kind() const;
+ IMG_Pixel get_key() const;
+ unsigned long int get_frames() const;
+ unsigned long int get_frame_width() const;
+ unsigned long int get_frame_height() const;
+ size_t get_resident() const;
+ unsigned long int get_hits() const;
+ unsigned long int get_misses() const;
+ void clear_cache();
+ Sprite_Sheet* get_handle();
+};
+
 class Surface
 {
  private:
  Screen *surface;
  IMG_Pixel *image;
+ const unsigned short int *packed;
+ unsigned short int *packed_buffer;
+ Image *cached;
+ Input_File asset;
+ bool shared;
  unsigned long int width;
  unsigned long int height;
+ unsigned long int pitch;
+ unsigned long int split;
+ unsigned long int revision;
+ void copy_pixel(IMG_Pixel *target,unsigned short int *target_packed,const size_t index,const size_t position) const;
+ void release_cached();
+ void replace_buffer(IMG_Pixel *buffer,unsigned short int *packed_target);
+ size_t get_layout_offset(const unsigned long int x,const unsigned long int y,const unsigned long int amount) const;
+ void change_layout(const unsigned long int amount);
  protected:
  void save();
  void restore();
  void clear_buffer();
  IMG_Pixel *create_buffer(const unsigned long int image_width,const unsigned long int image_height);
+ unsigned short int *create_packed_buffer(const unsigned long int image_width,const unsigned long int image_height);
  void load_from_buffer(Image &buffer);
+ void load_from_asset(AST_head &head);
+ void load_from_asset(const char *name,AST_head &head);
+ void load_from_asset(Pack_File &pack,const char *name,AST_head &head);
+ const unsigned char *get_asset_view(const size_t offset,const size_t length) const;
  void set_width(const unsigned long int image_width);
  void set_height(const unsigned long int image_height);
  void set_buffer(IMG_Pixel *buffer);
+ void set_packed_buffer(unsigned short int *buffer);
+ void split_frames(const unsigned long int amount);
+ void set_split(const unsigned long int amount);
+ unsigned long int get_split() const;
+ unsigned long int get_pitch() const;
  size_t get_offset(const unsigned long int start,const unsigned long int x,const unsigned long int y,const unsigned long int target_width);
  size_t get_offset(const unsigned long int start,const unsigned long int x,const unsigned long int y) const;
  void draw_image_pixel(const size_t offset,const unsigned long int x,const unsigned long int y);
  bool compare_pixels(const size_t first,const size_t second) const;
  unsigned long int get_surface_width() const;
  unsigned long int get_surface_height() const;
+ unsigned short int *get_surface_buffer();
+ unsigned long int get_revision() const;
  public:
  Surface();
  ~Surface();
  void initialize(Screen *screen);
  size_t get_length() const;
  IMG_Pixel *get_image();
+ const unsigned short int *get_packed_image() const;
+ bool check_packed() const;
  unsigned long int get_image_width() const;
  unsigned long int get_image_height() const;
  void mirror_image(const MIRROR_TYPE kind);
@@ -556,10 +1137,25 @@ class Background:public Canvas
  unsigned long int maximum_height;
  unsigned long int current;
  BACKGROUND_TYPE current_kind;
+ BG_Frame *cache;
+ size_t cache_amount;
+ size_t cache_limit;
+ unsigned long int cache_width;
+ unsigned long int cache_height;
+ unsigned long int cache_revision;
+ unsigned long int cache_stamp;
+ unsigned long int hits;
+ unsigned long int misses;
+ BACKGROUND_TYPE cache_kind;
  void get_maximum_width();
  void get_maximum_height();
  void slow_draw_background();
  void configure_background();
+ void create_cache();
+ void prepare_cache();
+ BG_Frame *get_cached_frame();
+ void fill_cached_frame(unsigned short int *target);
+ void draw_cached_frame(const unsigned short int *source);
  public:
  Background();
  ~Background();
@@ -569,9 +1165,68 @@ class Background:public Canvas
  void set_setting(const BACKGROUND_TYPE kind,const unsigned long int frames);
  void set_target(const unsigned long int target);
  void step();
+ void set_cache_limit(const size_t limit);
+ size_t get_cache_limit() const;
+ void clear_cache();
+ unsigned long int get_cache_hits() const;
+ unsigned long int get_cache_misses() const;
  void draw_background();
 };
 
+class Layer:public Surface
+{
+ private:
+ bool transparent;
+ unsigned long int offset_x;
+ unsigned long int offset_y;
+ unsigned long int factor;
+ unsigned long int layer_revision;
+ unsigned short int *pixels;
+ size_t *rows;
+ IMG_Span *spans;
+ void clear_layer();
+ void create_pixels();
+ void create_spans();
+ void prepare_layer();
+ unsigned long int wrap_offset(const unsigned long int offset,const long long int delta,const unsigned long int size) const;
+ long long int get_camera_shift(const long int camera) const;
+ void draw_row(unsigned short int *target,const size_t row,const unsigned long int shift,const unsigned long int length);
+ void draw_transparent_row(unsigned short int *target,const size_t row,const unsigned long int shift,const unsigned long int length);
+ public:
+ Layer();
+ ~Layer();
+ void load_layer(Image &buffer);
+ void set_transparent(const bool enabled);
+ bool get_transparent() const;
+ void set_parallax(const unsigned long int percent);
+ unsigned long int get_parallax() const;
+ void set_offset(const unsigned long int x,const unsigned long int y);
+ void scroll(const long int x,const long int y);
+ unsigned long int get_offset_x() const;
+ unsigned long int get_offset_y() const;
+ void draw_layer(const long int camera_x,const long int camera_y);
+ Layer* get_handle();
+};
+
+class Parallax
+{
+ private:
+ Layer *layers[8];
+ size_t amount;
+ long int camera_x;
+ long int camera_y;
+ public:
+ Parallax();
+ ~Parallax();
+ void add_layer(Layer *target);
+ void clear_layers();
+ size_t get_layers() const;
+ void set_camera(const long int x,const long int y);
+ long int get_camera_x() const;
+ long int get_camera_y() const;
+ void draw_parallax();
+};
+
 class Sprite:public Canvas
 {
  private:
@@ -580,13 +1235,47 @@ class Sprite:public Canvas
  unsigned long int current_y;
  unsigned long int sprite_width;
  unsigned long int sprite_height;
+ unsigned long int mask_width;
+ unsigned long int mask_height;
+ unsigned long int mask_frames;
+ unsigned long int mask_revision;
+ unsigned long int mirror;
+ size_t mask_length;
+ unsigned long int *masks[4];
+ const IMG_Span *asset_rows;
+ const IMG_Span *asset_spans;
+ const unsigned long int *asset_masks;
+ unsigned long int asset_width;
+ unsigned long int asset_height;
+ unsigned long int asset_frames;
+ unsigned long int asset_revision;
+ Sprite_Sheet *sheet;
+ unsigned long int sheet_serial;
+ unsigned long int sheet_mirror;
+ unsigned long int sheet_frame;
  SPRITE_TYPE current_kind;
+ bool check_asset() const;
+ void release_sheet();
+ void load_sheet_frame();
+ unsigned long int get_mask_frame() const;
+ bool check_visible(const size_t offset);
+ void read_asset(AST_head &head);
+ void draw_packed_sprite();
+ void draw_packed_spans();
  void draw_transparent_sprite();
  void draw_normal_sprite();
+ size_t get_frame_offset(const unsigned long int target) const;
+ void clear_masks();
+ void create_mask(unsigned long int *target,const size_t offset);
+ void create_masks();
+ void prepare_masks();
  public:
  Sprite();
  ~Sprite();
  void load_sprite(Image &buffer,const SPRITE_TYPE kind,const unsigned long int frames);
+ void load_asset(const char *name);
+ void load_asset(Pack_File &pack,const char *name);
+ void load_sheet(Sprite_Sheet *target);
  void set_transparent(const bool enabled);
  bool get_transparent() const;
  void set_x(const unsigned long int x);
@@ -605,6 +1294,10 @@ class Sprite:public Canvas
  unsigned long int get_height() const;
  Sprite* get_handle();
  Collision_Box get_box() const;
+ const unsigned long int *get_mask() const;
+ void mirror_image(const MIRROR_TYPE kind);
+ void horizontal_mirror();
+ void vertical_mirror();
  void set_kind(const SPRITE_TYPE kind);
  SPRITE_TYPE get_kind() const;
  void set_target(const unsigned long int target);
@@ -617,14 +1310,62 @@ class Sprite:public Canvas
  void draw_sprite(const bool transparency,const unsigned long int x,const unsigned long int y);
 };
 
+class Asset_Writer
+{
+ private:
+ Output_File target;
+ AST_head head;
+ unsigned long int sprite_width;
+ unsigned long int sprite_height;
+ size_t position;
+ size_t row_words;
+ unsigned short int *pixels;
+ IMG_Span *rows;
+ IMG_Span *spans;
+ unsigned char *masks;
+ void clear_asset();
+ size_t get_frame_offset(const unsigned long int frame) const;
+ bool check_opaque(Image &buffer,const size_t offset) const;
+ void create_pixels(Image &buffer);
+ void split_pixels();
+ void create_spans(Image &buffer);
+ void create_masks(Image &buffer);
+ unsigned long int write_section(void *data,const size_t length);
+ public:
+ Asset_Writer();
+ ~Asset_Writer();
+ void write_asset(const char *name,Image &buffer,const SPRITE_TYPE kind,const unsigned long int frames);
+};
+
 class Tileset:public Surface
 {
  private:
- size_t offset;
+ size_t selected;
+ bool transparent;
  unsigned long int tile_width;
  unsigned long int tile_height;
  unsigned long int rows;
  unsigned long int columns;
+ unsigned long int mask_width;
+ unsigned long int tiles_revision;
+ unsigned short int *tile_pixels;
+ unsigned long int *tile_masks;
+ TILE_Animation *animations;
+ size_t animation_amount;
+ unsigned short int *animation_index;
+ unsigned long int animation_time;
+ unsigned long int animation_start;
+ unsigned long int animation_tick;
+ unsigned long int animation_change;
+ unsigned long int animation_revision;
+ bool animation_clock;
+ void clear_animation(TILE_Animation &target);
+ TILE_Animation &get_animation_slot(const unsigned short int tile);
+ void clear_tiles();
+ void create_tiles();
+ void prepare_tiles();
+ void draw_tile_rows(unsigned short int *target,const size_t pitch,const unsigned long int width,const unsigned long int height);
+ void draw_transparent_rows(unsigned short int *target,const size_t pitch,const unsigned long int width,const unsigned long int height);
  public:
  Tileset();
  ~Tileset();
@@ -632,10 +1373,164 @@ class Tileset:public Surface
  unsigned long int get_tile_height() const;
  unsigned long int get_rows() const;
  unsigned long int get_columns() const;
+ void set_transparent(const bool enabled);
+ bool get_transparent() const;
  void select_tile(const unsigned long int row,const unsigned long int column);
  void draw_tile(const unsigned long int x,const unsigned long int y);
  void draw_tile(const unsigned long int row,const unsigned long int column,const unsigned long int x,const unsigned long int y);
+ void copy_tile(unsigned short int *target,const unsigned long int target_width);
  void load_tileset(Image &buffer,const unsigned long int row_amount,const unsigned long int column_amount);
+ void add_animation(const unsigned long int row,const unsigned long int column,const TILE_Frame *frames,const size_t amount);
+ void clear_animations();
+ size_t get_animations() const;
+ void update_animation();
+ void set_animation_time(const unsigned long int milliseconds);
+ unsigned long int get_animation_time() const;
+ unsigned long int get_animation_tick() const;
+ unsigned long int get_animation_change() const;
+ unsigned long int get_animation_revision() const;
+ bool check_animated(const unsigned short int tile) const;
+ unsigned short int get_animated_tile(const unsigned short int tile) const;
+ unsigned long int get_animation_stamp(const unsigned short int tile) const;
+ void select_animated_tile(const unsigned long int row,const unsigned long int column);
+ Tileset* get_handle();
+};
+
+class Tilemap
+{
+ private:
+ Screen *surface;
+ Tileset *tileset;
+ unsigned short int *tiles;
+ unsigned char *dirty;
+ MAP_Chunk *chunks;
+ size_t *animated;
+ size_t animated_amount;
+ bool animated_ready;
+ unsigned long int animation_tick;
+ unsigned long int animation_revision;
+ size_t resident;
+ size_t chunk_limit;
+ unsigned long int map_width;
+ unsigned long int map_height;
+ unsigned long int chunk_width;
+ unsigned long int chunk_height;
+ unsigned long int chunk_columns;
+ unsigned long int chunk_rows;
+ unsigned long int camera_x;
+ unsigned long int camera_y;
+ unsigned long int stamp;
+ void clear_chunks();
+ void clear_animated();
+ void clear_tilemap();
+ void mark_tile(const unsigned long int x,const unsigned long int y);
+ void create_animated();
+ void update_animated();
+ void create_chunks();
+ unsigned short int *get_chunk_memory();
+ void render_tile(MAP_Chunk &target,const unsigned long int x,const unsigned long int y);
+ void render_chunk(MAP_Chunk &target,const unsigned long int chunk_x,const unsigned long int chunk_y,const bool full);
+ MAP_Chunk &prepare_chunk(const unsigned long int chunk_x,const unsigned long int chunk_y);
+ void draw_chunk(const unsigned long int chunk_x,const unsigned long int chunk_y,const unsigned long int stop_x,const unsigned long int stop_y);
+ public:
+ Tilemap();
+ ~Tilemap();
+ void initialize(Screen *screen);
+ void load_tilemap(Tileset *target,const unsigned long int width,const unsigned long int height);
+ unsigned long int get_width() const;
+ unsigned long int get_height() const;
+ void set_tile(const unsigned long int x,const unsigned long int y,const unsigned long int row,const unsigned long int column);
+ unsigned long int get_tile_row(const unsigned long int x,const unsigned long int y) const;
+ unsigned long int get_tile_column(const unsigned long int x,const unsigned long int y) const;
+ void set_chunk_limit(const size_t limit);
+ size_t get_chunk_limit() const;
+ size_t get_resident() const;
+ size_t get_animated();
+ void set_camera(const unsigned long int x,const unsigned long int y);
+ unsigned long int get_camera_x() const;
+ unsigned long int get_camera_y() const;
+ void invalidate();
+ void draw_tilemap();
+ Tilemap* get_handle();
+};
+
+class Map_Stream
+{
+ private:
+ int device;
+ bool run;
+ pthread_t stream;
+ pthread_mutex_t lock;
+ pthread_cond_t signal;
+ MAP_head head;
+ MAP_Entry *index;
+ MAP_Slot *slots;
+ size_t *chunk_slots;
+ size_t slot_amount;
+ size_t chunk_limit;
+ size_t tile_length;
+ size_t collision_length;
+ unsigned long int chunk_columns;
+ unsigned long int chunk_rows;
+ unsigned long int focus_x;
+ unsigned long int focus_y;
+ unsigned long int margin;
+ unsigned long int stamp;
+ unsigned long int missed;
+ void open_device(const char *name);
+ void read_device(void *buffer,const size_t length,const size_t offset);
+ void read_head();
+ void read_index();
+ void create_slots();
+ void start_stream();
+ void stop_stream();
+ size_t get_victim();
+ void request_chunk(const unsigned long int chunk_x,const unsigned long int chunk_y,const unsigned long int distance);
+ void read_chunk(MAP_Slot &target,const unsigned long int chunk);
+ const MAP_Slot *get_slot(const unsigned long int x,const unsigned long int y);
+ public:
+ Map_Stream();
+ ~Map_Stream();
+ void set_chunk_limit(const size_t limit);
+ size_t get_chunk_limit() const;
+ void set_margin(const unsigned long int chunks);
+ unsigned long int get_margin() const;
+ void open(const char *name);
+ void close();
+ unsigned long int get_width() const;
+ unsigned long int get_height() const;
+ unsigned long int get_layers() const;
+ unsigned long int get_chunk_width() const;
+ unsigned long int get_chunk_height() const;
+ void set_focus(const unsigned long int x,const unsigned long int y);
+ void update();
+ bool check_resident(const unsigned long int x,const unsigned long int y);
+ unsigned short int get_tile(const unsigned long int layer,const unsigned long int x,const unsigned long int y);
+ bool check_collision(const unsigned long int x,const unsigned long int y);
+ size_t get_resident();
+ unsigned long int get_missed() const;
+ void load_chunks();
+ Map_Stream* get_handle();
+};
+
+class Map_Writer
+{
+ private:
+ Output_File target;
+ MAP_head head;
+ MAP_Entry *index;
+ size_t tile_length;
+ size_t collision_length;
+ unsigned long int chunk_columns;
+ unsigned long int chunk_rows;
+ unsigned long int position;
+ bool check_empty(const unsigned char *data,const size_t length) const;
+ public:
+ Map_Writer();
+ ~Map_Writer();
+ void create(const char *name,const unsigned long int width,const unsigned long int height,const unsigned short int chunk_width,const unsigned short int chunk_height,const unsigned short int layers);
+ void write_chunk(const unsigned long int chunk_x,const unsigned long int chunk_y,unsigned short int *tiles,unsigned char *collision);
+ void close();
 };
 
 class Text
@@ -657,11 +1552,98 @@ class Text
  void draw_text(const unsigned long int x,const unsigned long int y,const char *text);
 };
 
+class Font:public Surface
+{
+ private:
+ bool proportional;
+ bool tint;
+ unsigned short int color;
+ unsigned long int spacing;
+ unsigned long int glyph_width;
+ unsigned long int glyph_height;
+ unsigned long int font_revision;
+ unsigned short int *pixels;
+ FNT_Span *spans;
+ FNT_Glyph glyphs[128];
+ void clear_font();
+ size_t count_spans(size_t &length);
+ void create_glyph(const size_t target,size_t &span,size_t &offset);
+ void create_font();
+ void prepare_font();
+ const FNT_Glyph *get_glyph(const char target) const;
+ unsigned long int get_advance(const FNT_Glyph *glyph) const;
+ unsigned long int get_shift(const FNT_Glyph *glyph) const;
+ void draw_glyph(unsigned short int *target,const unsigned long int width,const unsigned long int height,const unsigned long int x,const unsigned long int y,const FNT_Glyph *glyph);
+ public:
+ Font();
+ ~Font();
+ void load_font(Image &buffer);
+ void set_proportional(const bool enabled);
+ bool get_proportional() const;
+ void set_spacing(const unsigned long int amount);
+ unsigned long int get_spacing() const;
+ void set_tint(const unsigned char red,const unsigned char green,const unsigned char blue);
+ void clear_tint();
+ bool get_tint() const;
+ unsigned long int get_font_width() const;
+ unsigned long int get_font_height() const;
+ unsigned long int get_glyph_width(const char target);
+ unsigned long int get_text_width(const char *text);
+ unsigned long int get_text_height(const char *text);
+ void draw_text(unsigned short int *target,const unsigned long int width,const unsigned long int height,const unsigned long int x,const unsigned long int y,const char *text);
+ void draw_text(const unsigned long int x,const unsigned long int y,const char *text);
+ void draw_character(const unsigned long int x,const unsigned long int y,const char target);
+ size_t get_text_spans(const char *text,size_t &length);
+ void create_text_spans(const char *text,FNT_Span *target,unsigned short int *output);
+ void draw_spans(const FNT_Span *target,const size_t amount,const unsigned short int *source,const unsigned long int x,const unsigned long int y);
+ Font* get_handle();
+};
+
+class Text_Label
+{
+ private:
+ Font *font;
+ char *text;
+ size_t capacity;
+ FNT_Span *spans;
+ size_t span_amount;
+ unsigned short int *pixels;
+ unsigned long int label_x;
+ unsigned long int label_y;
+ unsigned long int label_width;
+ unsigned long int label_height;
+ unsigned long int renders;
+ bool changed;
+ void clear_spans();
+ void clear_label();
+ void store_text(const char *target);
+ void render_label();
+ public:
+ Text_Label();
+ ~Text_Label();
+ void load_font(Font *target);
+ void set_position(const unsigned long int x,const unsigned long int y);
+ unsigned long int get_x() const;
+ unsigned long int get_y() const;
+ void set_text(const char *target);
+ void set_number(const unsigned long int value);
+ void set_number(const unsigned long int value,const size_t digits);
+ const char *get_text() const;
+ unsigned long int get_width();
+ unsigned long int get_height();
+ unsigned long int get_renders() const;
+ void invalidate();
+ void draw_label();
+ void draw_label(const unsigned long int x,const unsigned long int y);
+ Text_Label* get_handle();
+};
+
 class Collision
 {
  private:
  Collision_Box first;
  Collision_Box second;
+ unsigned long int get_mask_bits(const Collision_Box &target,const unsigned long int x,const unsigned long int y,const unsigned long int amount) const;
  public:
  Collision();
  ~Collision();
@@ -672,7 +1654,96 @@ class Collision
  bool check_horizontal_collision(const Collision_Box &first_target,const Collision_Box &second_target);
  bool check_vertical_collision(const Collision_Box &first_target,const Collision_Box &second_target);
  bool check_collision(const Collision_Box &first_target,const Collision_Box &second_target);
+ bool check_mask_collision() const;
+ bool check_mask_collision(const Collision_Box &first_target,const Collision_Box &second_target);
  Collision_Box generate_box(const unsigned long int x,const unsigned long int y,const unsigned long int width,const unsigned long int height) const;
 };
 
+class Asset_Loader
+{
+ private:
+ bool run;
+ pthread_t loader;
+ pthread_mutex_t lock;
+ pthread_cond_t signal;
+ pthread_cond_t finished;
+ LOAD_Job *jobs;
+ size_t job_amount;
+ size_t job_limit;
+ unsigned long int order;
+ unsigned long int io_time;
+ unsigned long int decode_time;
+ unsigned long int get_time() const;
+ void start_loader();
+ void stop_loader();
+ void check_handle(const size_t handle) const;
+ size_t add_job(const char *name,void *target,const unsigned char kind,const unsigned long int priority);
+ size_t get_next_job() const;
+ void run_job(LOAD_Job &target);
+ public:
+ Asset_Loader();
+ ~Asset_Loader();
+ size_t load_image(Image &target,const char *name,const IMAGE_TYPE kind,const unsigned long int priority);
+ size_t load_audio(Audio &target,const char *name,const unsigned long int priority);
+ LOAD_STATE get_state(const size_t handle);
+ bool check_ready(const size_t handle);
+ void wait(const size_t handle);
+ void wait_all();
+ bool cancel(const size_t handle);
+ void set_priority(const size_t handle,const unsigned long int priority);
+ size_t get_pending();
+ unsigned long int get_io_time(const size_t handle);
+ unsigned long int get_decode_time(const size_t handle);
+ unsigned long int get_total_io_time();
+ unsigned long int get_total_decode_time();
+ void clear_jobs();
+ void stop();
+ void load_assets();
+ Asset_Loader* get_handle();
+};
+
+class Asset_Cache
+{
+ private:
+ pthread_mutex_t lock;
+ pthread_cond_t loaded;
+ Memory memory;
+ CACHE_Entry *entries;
+ size_t entry_amount;
+ size_t entry_limit;
+ size_t budget;
+ size_t resident;
+ unsigned long int free_limit;
+ unsigned long int stamp;
+ unsigned long int hits;
+ unsigned long int misses;
+ unsigned long int evictions;
+ Image *create_image();
+ size_t find_entry(const char *name,const unsigned char kind) const;
+ size_t find_image(const Image *target) const;
+ size_t add_entry(const char *name,const unsigned char kind);
+ void remove_entry(const size_t entry);
+ bool check_pressure();
+ size_t get_victim() const;
+ void evict_entries();
+ public:
+ Asset_Cache();
+ ~Asset_Cache();
+ Image *acquire_image(const char *name,const IMAGE_TYPE kind);
+ void retain_image(Image *target);
+ void release_image(Image *target);
+ void set_budget(const size_t bytes);
+ size_t get_budget() const;
+ void set_free_limit(const unsigned long int bytes);
+ unsigned long int get_free_limit() const;
+ void trim();
+ void clear();
+ size_t get_entries();
+ size_t get_resident();
+ unsigned long int get_hits();
+ unsigned long int get_misses();
+ unsigned long int get_evictions();
+ Asset_Cache* get_handle();
+};
+
 }
\ No newline at end of file
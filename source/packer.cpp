@@ -0,0 +1,45 @@
+#include "dinguxgdk.h"
+
+void show_usage()
+{
+ puts("Usage: packer archive [-c] [-s] file...");
+ puts("-c: compress next files");
+ puts("-s: store next files without compression");
+}
+
+int main(int argc,char *argv[])
+{
+ DINGUXGDK::Pack_Writer writer;
+ DINGUXGDK::Pack_File pack;
+ int index;
+ bool compress;
+ size_t entry;
+ if (argc<3)
+ {
+  show_usage();
+  return EXIT_FAILURE;
+ }
+ compress=false;
+ writer.create(argv[1]);
+ for (index=2;index<argc;++index)
+ {
+  if (strcmp(argv[index],"-c")==0)
+  {
+   compress=true;
+   continue;
+  }
+  if (strcmp(argv[index],"-s")==0)
+  {
+   compress=false;
+   continue;
+  }
+  writer.add_file(argv[index],argv[index],compress);
+ }
+ writer.close();
+ pack.open(argv[1]);
+ for (entry=0;entry<pack.get_amount();++entry)
+ {
+  printf("%s %lu%s\n",pack.get_name(entry),static_cast<unsigned long int>(pack.get_size(entry)),pack.check_compressed(entry)==true ? " compressed":"");
+ }
+ return EXIT_SUCCESS;
+}
@@ -5,18 +5,20 @@
 
 unsigned char MAP_ROWS[MAP_WIDTH]={1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1};
 unsigned char MAP_COLUMNS[MAP_HEIGHT]={2,2,2,2,2,2,2,2,2,2,2,2,2,2,2,2};
+TILE_Frame GRASS_ANIMATION[2]={{1,2,500},{2,2,500}};
 
-DINGUXGDK::Tileset tilemap;
+DINGUXGDK::Tileset tileset;
+DINGUXGDK::Tilemap tilemap;
 
-void draw_map()
+void create_map()
 {
  unsigned long int row,column;
+ tilemap.load_tilemap(tileset.get_handle(),MAP_WIDTH,MAP_HEIGHT);
  for (row=0;row<MAP_WIDTH;++row)
  {
   for (column=0;column<MAP_HEIGHT;++column)
   {
-   tilemap.select_tile(MAP_ROWS[row],MAP_COLUMNS[column]);
-   tilemap.draw_tile(row*tilemap.get_tile_width(),column*tilemap.get_tile_height());
+   tilemap.set_tile(row,column,MAP_ROWS[row],MAP_COLUMNS[column]);
   }
 
  }
@@ -31,6 +33,7 @@ int main()
  DINGUXGDK::Image image;
  DINGUXGDK::Gamepad gamepad;
  font.initialize(screen.get_handle());
+ tileset.initialize(screen.get_handle());
  tilemap.initialize(screen.get_handle());
  gamepad.initialize();
  image.load_tga("font.tga");
@@ -38,15 +41,16 @@ int main()
  text.load_font(font.get_handle());
  text.set_position(0,0);
  image.load_tga("grass.tga");
- tilemap.load_tileset(image,6,3);
+ tileset.load_tileset(image,6,3);
+ tileset.add_animation(1,2,GRASS_ANIMATION,2);
  screen.initialize();
- draw_map();
- screen.save();
+ create_map();
  while (true)
  {
   gamepad.update();
   if (gamepad.check_hold(BUTTON_A)==true) break;
-  screen.restore();
+  tileset.update_animation();
+  tilemap.draw_tilemap();
   text.draw_text("Press A to exit");
   screen.update();
  }